@@ -26,6 +26,9 @@
  */
 
 #include <linux/debugfs.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/overflow.h>
 #include <linux/poll.h>
 #include <linux/fsnotify.h>
 
@@ -300,6 +303,45 @@ static ssize_t debug_hw_reset_write(struct file *filp, const char __user *buff,
 	return count;
 }
 
+static int debug_boot_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct qm35_boot_stats stats;
+
+	mutex_lock(&qm35_hdl->ctrl_lock);
+	stats = qm35_hdl->boot_stats;
+	mutex_unlock(&qm35_hdl->ctrl_lock);
+
+	seq_printf(s, "boots: %u\n", stats.boots);
+	seq_printf(s, "timeouts: %u\n", stats.timeouts);
+	seq_printf(s, "last_us: %u\n", stats.last_us);
+	seq_printf(s, "min_us: %u\n", stats.min_us);
+	seq_printf(s, "max_us: %u\n", stats.max_us);
+	seq_printf(s, "avg_us: %llu\n",
+		   stats.boots ? div_u64(stats.total_us, stats.boots) : 0);
+	return 0;
+}
+
+static int debug_boot_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_boot_show, inodep->i_private);
+}
+
+static ssize_t debug_boot_write(struct file *filp, const char __user *buff,
+				size_t count, loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+
+	/* any write resets the statistics */
+	mutex_lock(&qm35_hdl->ctrl_lock);
+	memset(&qm35_hdl->boot_stats, 0, sizeof(qm35_hdl->boot_stats));
+	mutex_unlock(&qm35_hdl->ctrl_lock);
+	return count;
+}
+
 static const struct file_operations debug_enable_fops = {
 	.owner = THIS_MODULE,
 	.write = debug_enable_write,
@@ -337,6 +379,15 @@ static const struct file_operations debug_hw_reset_fops = {
 	.write = debug_hw_reset_write,
 };
 
+static const struct file_operations debug_boot_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_boot_open,
+	.read = seq_read,
+	.write = debug_boot_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 int debug_create_module_entry(struct debug *debug,
 			      struct log_module *log_module)
 {
@@ -402,8 +453,538 @@ static int debug_socid_show(struct seq_file *s, void *unused)
 	return 0;
 }
 
+static int debug_hsspi_stats_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi_work_stats *works = &qm35_hdl->hsspi.works;
+	static const char *const layouts[HSSPI_LAYOUT_MAX] = {
+		"split", "contiguous", "duplex"
+	};
+	struct hsspi_xfer_stats *xs;
+	u64 frames;
+	int i;
+
+	seq_printf(s, "works_in_use: %d\n", atomic_read(&works->in_use));
+	seq_printf(s, "works_high_water: %d\n",
+		   atomic_read(&works->high_water));
+	seq_printf(s, "duplex_controller: %d\n", qm35_hdl->hsspi.duplex_ctlr);
+	seq_printf(s, "duplex_firmware: %s\n",
+		   test_bit(HSSPI_FLAGS_DUPLEX_FW, qm35_hdl->hsspi.flags) ?
+			   "yes" :
+		   test_bit(HSSPI_FLAGS_DUPLEX_NO_FW, qm35_hdl->hsspi.flags) ?
+			   "no" :
+			   "unknown");
+	seq_printf(s, "duplex_merged: %llu\n",
+		   READ_ONCE(qm35_hdl->hsspi.duplex_merged));
+	seq_printf(s, "async_engine: %d\n",
+		   READ_ONCE(qm35_hdl->hsspi.async_engine));
+	seq_printf(s, "async_xfers: %llu\n",
+		   READ_ONCE(qm35_hdl->hsspi.async.xfers_count));
+	seq_printf(s, "async_fallbacks: %llu\n",
+		   READ_ONCE(qm35_hdl->hsspi.async.fallbacks));
+	seq_printf(s, "contiguous: %d\n",
+		   READ_ONCE(qm35_hdl->hsspi.contiguous));
+	seq_printf(s, "error_resets: %llu\n",
+		   READ_ONCE(qm35_hdl->hsspi.error_resets));
+	for (i = 0; i < ARRAY_SIZE(layouts); i++) {
+		xs = &qm35_hdl->hsspi.xfer_stats[i];
+		frames = READ_ONCE(xs->frames);
+		seq_printf(s, "%s_frames: %llu\n", layouts[i], frames);
+		seq_printf(s, "%s_avg_overhead_ns: %llu\n", layouts[i],
+			   frames ? div64_u64(READ_ONCE(xs->overhead_ns),
+					      frames) :
+				    0);
+		seq_printf(s, "%s_max_overhead_ns: %llu\n", layouts[i],
+			   READ_ONCE(xs->max_overhead_ns));
+	}
+	return 0;
+}
+
+static int debug_hsspi_queues_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi *hsspi = &qm35_hdl->hsspi;
+	int i;
+
+	seq_puts(s,
+		 "ul prio depth max_depth dequeued avg_wait_us max_wait_us expired coalesced\n");
+
+	for (i = 0; i < ARRAY_SIZE(hsspi->queues); i++) {
+		struct hsspi_queue *q = &hsspi->queues[i];
+		u64 dequeued = READ_ONCE(q->dequeued);
+		u64 avg_wait_ns =
+			dequeued ? div64_u64(READ_ONCE(q->wait_ns), dequeued) : 0;
+
+		seq_printf(s, "%2d %4u %5d %9d %8llu %11llu %11llu %7llu %9llu\n",
+			   i, READ_ONCE(q->prio), atomic_read(&q->depth),
+			   atomic_read(&q->max_depth), dequeued,
+			   div_u64(avg_wait_ns, NSEC_PER_USEC),
+			   div_u64(READ_ONCE(q->max_wait_ns), NSEC_PER_USEC),
+			   READ_ONCE(q->expired), READ_ONCE(q->coalesced));
+	}
+	return 0;
+}
+
+static int debug_hsspi_queues_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_hsspi_queues_show, inodep->i_private);
+}
+
+static ssize_t debug_hsspi_queues_write(struct file *filp,
+					const char __user *buff, size_t count,
+					loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	unsigned int ul, prio;
+	char buf[16];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, buff, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	/* "<ul> <prio>" */
+	if (sscanf(buf, "%u %u", &ul, &prio) != 2 || prio > U8_MAX)
+		return -EINVAL;
+
+	if (hsspi_set_layer_prio(&qm35_hdl->hsspi, ul, prio))
+		return -EINVAL;
+
+	return count;
+}
+
+static const struct file_operations debug_hsspi_queues_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_queues_open,
+	.read = seq_read,
+	.write = debug_hsspi_queues_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int debug_hsspi_ss_ready_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi_ss_ready_stats *stats = &qm35_hdl->hsspi.ss_ready_stats;
+	int i;
+
+	seq_printf(s, "spin_us: %u\n",
+		   READ_ONCE(qm35_hdl->hsspi.ss_ready_spin_us));
+	seq_printf(s, "avg_latency_ns: %llu\n",
+		   READ_ONCE(qm35_hdl->hsspi.ss_ready_avg_ns));
+	seq_printf(s, "spun: %llu\n", READ_ONCE(stats->spun));
+	seq_printf(s, "slept: %llu\n", READ_ONCE(stats->slept));
+	seq_printf(s, "spin_us_total: %llu\n",
+		   div_u64(READ_ONCE(stats->spin_ns), NSEC_PER_USEC));
+
+	seq_puts(s, "latency_us spun slept\n");
+	for (i = 0; i < ARRAY_SIZE(stats->spin_hist.count); i++)
+		seq_printf(s, "%10u %4lld %5lld\n", i ? 1u << (i - 1) : 0,
+			   atomic64_read(&stats->spin_hist.count[i]),
+			   atomic64_read(&stats->sleep_hist.count[i]));
+	return 0;
+}
+
+static int debug_hsspi_ss_ready_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_hsspi_ss_ready_show,
+			   inodep->i_private);
+}
+
+static ssize_t debug_hsspi_ss_ready_write(struct file *filp,
+					  const char __user *buff,
+					  size_t count, loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi_ss_ready_stats *stats = &qm35_hdl->hsspi.ss_ready_stats;
+
+	/* any write resets the statistics */
+	WRITE_ONCE(stats->spun, 0);
+	WRITE_ONCE(stats->slept, 0);
+	WRITE_ONCE(stats->spin_ns, 0);
+	hsspi_hist_reset(&stats->spin_hist);
+	hsspi_hist_reset(&stats->sleep_hist);
+	return count;
+}
+
+static const struct file_operations debug_hsspi_ss_ready_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_ss_ready_open,
+	.read = seq_read,
+	.write = debug_hsspi_ss_ready_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int debug_hsspi_latency_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	static const char *const layers[UL_MAX_IDX] = {
+		"none", "boot", "uci", "coredump", "log", "test",
+	};
+	static const char *const phases[HSSPI_PHASE_MAX] = {
+		"enqueue", "queued", "ss_ready", "xfer", "callback",
+	};
+	struct hsspi_hist *hist;
+	u64 total;
+	int ul, phase, i;
+
+	seq_puts(s, "layer    phase   ");
+	for (i = 0; i < ARRAY_SIZE(hist->count); i++)
+		seq_printf(s, " %6u", i ? 1u << (i - 1) : 0);
+	seq_puts(s, " (us)\n");
+
+	for (ul = 0; ul < UL_MAX_IDX; ul++) {
+		for (phase = 0; phase < HSSPI_PHASE_MAX; phase++) {
+			hist = &qm35_hdl->hsspi.latency[ul][phase];
+
+			total = 0;
+			for (i = 0; i < ARRAY_SIZE(hist->count); i++)
+				total += atomic64_read(&hist->count[i]);
+			if (!total)
+				continue;
+
+			seq_printf(s, "%-8s %-8s", layers[ul], phases[phase]);
+			for (i = 0; i < ARRAY_SIZE(hist->count); i++)
+				seq_printf(s, " %6lld",
+					   atomic64_read(&hist->count[i]));
+			seq_putc(s, '\n');
+		}
+	}
+	return 0;
+}
+
+static int debug_hsspi_latency_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_hsspi_latency_show, inodep->i_private);
+}
+
+static ssize_t debug_hsspi_latency_write(struct file *filp,
+					 const char __user *buff, size_t count,
+					 loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	int ul, phase;
+
+	/* any write resets the histograms */
+	for (ul = 0; ul < UL_MAX_IDX; ul++)
+		for (phase = 0; phase < HSSPI_PHASE_MAX; phase++)
+			hsspi_hist_reset(&qm35_hdl->hsspi.latency[ul][phase]);
+	return count;
+}
+
+static const struct file_operations debug_hsspi_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_latency_open,
+	.read = seq_read,
+	.write = debug_hsspi_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * struct debug_rec - snapshot of the HSSPI flight recorder
+ * @len: number of entries
+ * @entries: the entries, oldest first
+ */
+struct debug_rec {
+	unsigned int len;
+	struct hsspi_rec_entry entries[];
+};
+
+static struct debug_rec *debug_rec_snapshot(struct hsspi *hsspi)
+{
+	unsigned int len = hsspi->rec.entries ? hsspi->rec.mask + 1 : 0;
+	struct debug_rec *rec;
+
+	rec = kvmalloc(struct_size(rec, entries, len), GFP_KERNEL);
+	if (rec)
+		rec->len = hsspi_rec_snapshot(hsspi, rec->entries, len);
+	return rec;
+}
+
+static int debug_hsspi_rec_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct debug_rec *rec;
+	unsigned int i;
+
+	rec = debug_rec_snapshot(&qm35_hdl->hsspi);
+	if (!rec)
+		return -ENOMEM;
+
+	for (i = 0; i < rec->len; i++)
+		seq_printf(s, HSSPI_REC_FMT "\n",
+			   HSSPI_REC_ARG(&rec->entries[i]));
+
+	kvfree(rec);
+	return 0;
+}
+
+static int debug_hsspi_rec_bin_open(struct inode *inodep, struct file *filep)
+{
+	struct debug *debug = inodep->i_private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+
+	filep->private_data = debug_rec_snapshot(&qm35_hdl->hsspi);
+	if (!filep->private_data)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static ssize_t debug_hsspi_rec_bin_read(struct file *filep, char __user *buff,
+					size_t count, loff_t *off)
+{
+	struct debug_rec *rec = filep->private_data;
+
+	return simple_read_from_buffer(buff, count, off, rec->entries,
+				       rec->len * sizeof(rec->entries[0]));
+}
+
+static int debug_hsspi_rec_bin_release(struct inode *inodep,
+				       struct file *filep)
+{
+	kvfree(filep->private_data);
+	return 0;
+}
+
+static const struct file_operations debug_hsspi_rec_bin_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_rec_bin_open,
+	.read = debug_hsspi_rec_bin_read,
+	.llseek = default_llseek,
+	.release = debug_hsspi_rec_bin_release,
+};
+
+static int debug_hsspi_clocks_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi *hsspi = &qm35_hdl->hsspi;
+	struct hsspi_throughput *tp;
+	u64 kbps[2];
+	int ul, dir;
+
+	seq_printf(s, "default_hz: %u\n", hsspi->spi->max_speed_hz);
+	seq_puts(s, "ul  header_hz     tx_hz     rx_hz  tx_kB/s  rx_kB/s\n");
+
+	for (ul = 0; ul < UL_MAX_IDX; ul++) {
+		for (dir = 0; dir < 2; dir++) {
+			tp = &hsspi->throughput[ul][dir];
+			kbps[dir] = READ_ONCE(tp->ns) ?
+					    div64_u64(READ_ONCE(tp->bytes) *
+							      (NSEC_PER_SEC / 1000),
+						      READ_ONCE(tp->ns)) :
+					    0;
+		}
+
+		seq_printf(s, "%2d %10u %9u %9u %8llu %8llu\n", ul,
+			   READ_ONCE(hsspi->speed_hz[ul][HSSPI_CLK_HEADER]),
+			   READ_ONCE(hsspi->speed_hz[ul][HSSPI_CLK_TX]),
+			   READ_ONCE(hsspi->speed_hz[ul][HSSPI_CLK_RX]),
+			   kbps[0], kbps[1]);
+	}
+	return 0;
+}
+
+static int debug_hsspi_clocks_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_hsspi_clocks_show, inodep->i_private);
+}
+
+static ssize_t debug_hsspi_clocks_write(struct file *filp,
+					const char __user *buff, size_t count,
+					loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct hsspi *hsspi = &qm35_hdl->hsspi;
+	unsigned int ul, hz[HSSPI_CLK_MAX];
+	char buf[48];
+	int i;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, buff, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	/* "reset" clears the throughput measurements */
+	if (sysfs_streq(buf, "reset")) {
+		memset(hsspi->throughput, 0, sizeof(hsspi->throughput));
+		return count;
+	}
+
+	/* "<ul> <header_hz> <tx_hz> <rx_hz>" */
+	if (sscanf(buf, "%u %u %u %u", &ul, &hz[HSSPI_CLK_HEADER],
+		   &hz[HSSPI_CLK_TX], &hz[HSSPI_CLK_RX]) != 4)
+		return -EINVAL;
+
+	for (i = 0; i < HSSPI_CLK_MAX; i++)
+		if (hsspi_set_speed(hsspi, ul, i, hz[i]))
+			return -EINVAL;
+
+	return count;
+}
+
+static const struct file_operations debug_hsspi_clocks_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_clocks_open,
+	.read = seq_read,
+	.write = debug_hsspi_clocks_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int debug_hsspi_calibration_show(struct seq_file *s, void *unused)
+{
+	const struct hsspi_test_calib *calib = hsspi_test_get_calib();
+	int i;
+
+	seq_printf(s, "speed_hz: %u\n", calib->speed_hz);
+	seq_puts(s, "tested_hz errors\n");
+	for (i = 0; i < calib->steps; i++)
+		seq_printf(s, "%9u %6u\n", calib->tested_hz[i],
+			   calib->errors[i]);
+	return 0;
+}
+
+static int debug_hsspi_calibration_open(struct inode *inodep,
+					struct file *filep)
+{
+	return single_open(filep, debug_hsspi_calibration_show,
+			   inodep->i_private);
+}
+
+static ssize_t debug_hsspi_calibration_write(struct file *filp,
+					     const char __user *buff,
+					     size_t count, loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	struct spi_device *spi = qm35_hdl->spi;
+	u32 min_hz = HSSPI_TEST_CALIB_MIN_HZ;
+	u32 max_hz = spi->controller->max_speed_hz ?: spi->max_speed_hz;
+	u32 step_hz = HSSPI_TEST_CALIB_STEP_HZ;
+	u32 ul_mask = 0;
+	char buf[48];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, buff, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	/* "auto [<ul_mask>]" or "<min_hz> <max_hz> <step_hz> [<ul_mask>]" */
+	if (sscanf(buf, "auto %i", &ul_mask) < 1 && !sysfs_streq(buf, "auto") &&
+	    sscanf(buf, "%u %u %u %i", &min_hz, &max_hz, &step_hz,
+		   &ul_mask) < 3)
+		return -EINVAL;
+
+	ret = hsspi_test_calibrate(&qm35_hdl->hsspi, ul_mask, min_hz, max_hz,
+				   step_hz);
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static const struct file_operations debug_hsspi_calibration_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_calibration_open,
+	.read = seq_read,
+	.write = debug_hsspi_calibration_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int debug_hsspi_sched_show(struct seq_file *s, void *unused)
+{
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+
+	seq_printf(s, "prio: %d\n", READ_ONCE(qm35_hdl->hsspi.sched_prio));
+	seq_printf(s, "cpus: %*pbl\n",
+		   cpumask_pr_args(&qm35_hdl->hsspi.sched_cpus));
+	return 0;
+}
+
+static int debug_hsspi_sched_open(struct inode *inodep, struct file *filep)
+{
+	return single_open(filep, debug_hsspi_sched_show, inodep->i_private);
+}
+
+static ssize_t debug_hsspi_sched_write(struct file *filp,
+				       const char __user *buff, size_t count,
+				       loff_t *off)
+{
+	struct seq_file *s = filp->private_data;
+	struct debug *debug = (struct debug *)s->private;
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
+	cpumask_var_t cpus;
+	char buf[64], list[64];
+	int prio, n, ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, buff, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	/* "<prio> [<cpu list>]" */
+	n = sscanf(buf, "%d %63s", &prio, list);
+	if (n < 1)
+		return -EINVAL;
+
+	if (!zalloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (n == 2 && cpulist_parse(list, cpus))
+		ret = -EINVAL;
+	else
+		ret = qm35_set_sched(qm35_hdl, prio, n == 2 ? cpus : NULL);
+
+	free_cpumask_var(cpus);
+	return ret ? ret : count;
+}
+
+static const struct file_operations debug_hsspi_sched_fops = {
+	.owner = THIS_MODULE,
+	.open = debug_hsspi_sched_open,
+	.read = seq_read,
+	.write = debug_hsspi_sched_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 DEFINE_SHOW_ATTRIBUTE(debug_devid);
 DEFINE_SHOW_ATTRIBUTE(debug_socid);
+DEFINE_SHOW_ATTRIBUTE(debug_hsspi_stats);
+DEFINE_SHOW_ATTRIBUTE(debug_hsspi_rec);
 
 void debug_soc_info_available(struct debug *debug)
 {
@@ -442,6 +1023,7 @@ int debug_init_root(struct debug *debug, struct dentry *root)
 
 int debug_init(struct debug *debug)
 {
+	struct qm35_ctx *qm35_hdl = container_of(debug, struct qm35_ctx, debug);
 	struct dentry *file;
 
 	init_waitqueue_head(&debug->wq);
@@ -467,6 +1049,94 @@ int debug_init(struct debug *debug)
 		goto unregister;
 	}
 
+	file = debugfs_create_file("boot", 0644, debug->chip_dir, debug,
+				   &debug_boot_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/chip/boot\n");
+		goto unregister;
+	}
+
+	debug->hsspi_dir = debugfs_create_dir("hsspi", debug->root_dir);
+	if (!debug->hsspi_dir) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("stats", 0444, debug->hsspi_dir, debug,
+				   &debug_hsspi_stats_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/stats\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("queues", 0644, debug->hsspi_dir, debug,
+				   &debug_hsspi_queues_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/queues\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("ss_ready", 0644, debug->hsspi_dir, debug,
+				   &debug_hsspi_ss_ready_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/ss_ready\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("latency", 0644, debug->hsspi_dir, debug,
+				   &debug_hsspi_latency_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/latency\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("flight_recorder", 0444, debug->hsspi_dir,
+				   debug, &debug_hsspi_rec_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/flight_recorder\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("flight_recorder.bin", 0444,
+				   debug->hsspi_dir, debug,
+				   &debug_hsspi_rec_bin_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/flight_recorder.bin\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("clocks", 0644, debug->hsspi_dir, debug,
+				   &debug_hsspi_clocks_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/clocks\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("calibration", 0644, debug->hsspi_dir,
+				   debug, &debug_hsspi_calibration_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/calibration\n");
+		goto unregister;
+	}
+
+	file = debugfs_create_file("sched", 0644, debug->hsspi_dir, debug,
+				   &debug_hsspi_sched_fops);
+	if (!file) {
+		pr_err("qm35: failed to create /sys/kernel/debug/uwb0/hsspi/sched\n");
+		goto unregister;
+	}
+
+	debugfs_create_u32("starvation_limit", 0644, debug->hsspi_dir,
+			   &qm35_hdl->hsspi.starvation_limit);
+	debugfs_create_u32("coalesce_delay_us", 0644, debug->hsspi_dir,
+			   &qm35_hdl->hsspi.coalesce_delay_us);
+	debugfs_create_u32("full_duplex", 0644, debug->hsspi_dir,
+			   &qm35_hdl->hsspi.full_duplex);
+	debugfs_create_bool("contiguous", 0644, debug->hsspi_dir,
+			    &qm35_hdl->hsspi.contiguous);
+	debugfs_create_u32("ss_ready_spin_us", 0644, debug->hsspi_dir,
+			   &qm35_hdl->hsspi.ss_ready_spin_us);
+
 	file = debugfs_create_file("enable", 0644, debug->fw_dir, debug,
 				   &debug_enable_fops);
 	if (!file) {
@@ -59,6 +59,7 @@ struct debug {
 	struct dentry *root_dir;
 	struct dentry *fw_dir;
 	struct dentry *chip_dir;
+	struct dentry *hsspi_dir;
 	const struct debug_trace_ops *trace_ops;
 	const struct debug_coredump_ops *coredump_ops;
 	struct wait_queue_head wq;
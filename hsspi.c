@@ -27,7 +27,21 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/version.h>
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mempool.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0))
+#include <uapi/linux/sched/types.h>
+#endif
+
+#include <spi_rom_protocol.h>
 
 #include "qm35-trace.h"
 #include "hsspi.h"
@@ -46,24 +60,21 @@
 #define SS_READY_TIMEOUT_MS (250)
 
 #define MAX_SUCCESSIVE_ERRORS (5)
+
+/* Maximum payload of a coalesced TX frame */
+#define HSSPI_MAX_FRAME_LEN (MAX_STC_FRAME_LEN - HSSPI_HEADROOM)
+/* unacknowledged full-duplex writes before giving up on the firmware */
+#define HSSPI_DUPLEX_PROBES 4
+
+/* spi_xfer() flags */
+#define HSSPI_XFER_DUPLEX BIT(0)
+#define HSSPI_XFER_HEADROOM BIT(1)
 #define SPI_CS_SETUP_DELAY_US (5)
 
 #ifdef HSSPI_MANUAL_CS_SETUP
 #define HSSPI_MANUAL_CS_SETUP_US SPI_CS_SETUP_DELAY_US
 #endif
 
-struct hsspi_work {
-	struct list_head list;
-	enum hsspi_work_type type;
-	union {
-		struct {
-			struct hsspi_block *blk;
-			struct hsspi_layer *layer;
-		} tx;
-		struct completion *completion;
-	};
-};
-
 int test_sleep_after_ss_ready_us = 0;
 
 static inline bool layer_id_is_valid(struct hsspi *hsspi, u8 ul)
@@ -71,11 +82,453 @@ static inline bool layer_id_is_valid(struct hsspi *hsspi, u8 ul)
 	return (ul < ARRAY_SIZE(hsspi->layers));
 }
 
+static struct hsspi_layer *hsspi_get_layer(struct hsspi *hsspi, u8 ul)
+{
+	struct hsspi_layer *layer;
+	unsigned long flags;
+
+	if (!layer_id_is_valid(hsspi, ul))
+		return NULL;
+
+	spin_lock_irqsave(&hsspi->lock, flags);
+	layer = hsspi->layers[ul];
+	spin_unlock_irqrestore(&hsspi->lock, flags);
+
+	return layer;
+}
+
+/* Default TX priorities of the upper layers, 0 is the highest */
+static const u8 hsspi_default_prio[UL_MAX_IDX] = {
+	[UL_RESERVED] = 3,
+	[UL_BOOT_FLASH] = 3,
+	[UL_UCI_APP] = 0,
+	[UL_COREDUMP] = 1,
+	[UL_LOG] = 2,
+	[UL_TEST_HSSPI] = 3,
+};
+
+/**
+ * hsspi_atomic_max() - atomically raise a maximum
+ *
+ * @max: &atomic_t holding the maximum
+ * @val: new value
+ */
+static void hsspi_atomic_max(atomic_t *max, int val)
+{
+	int old = atomic_read(max);
+
+	while (val > old && !atomic_try_cmpxchg(max, &old, val))
+		;
+}
+
+/**
+ * hsspi_work_get() - take the TX work embedded in a block
+ *
+ * @hsspi: &struct hsspi
+ * @blk: &struct hsspi_block to send
+ *
+ * Only accounts the works in use: each block carries its own work, so
+ * there is nothing to run out of. Lockless, can be called from any
+ * context.
+ *
+ * Return: the &struct hsspi_work embedded in @blk.
+ */
+static struct hsspi_work *hsspi_work_get(struct hsspi *hsspi,
+					 struct hsspi_block *blk)
+{
+	struct hsspi_work_stats *stats = &hsspi->works;
+
+	hsspi_atomic_max(&stats->high_water, atomic_inc_return(&stats->in_use));
+
+	return &blk->work;
+}
+
+/**
+ * hsspi_work_put() - account a TX work no longer in use
+ *
+ * @hsspi: &struct hsspi
+ */
+static void hsspi_work_put(struct hsspi *hsspi)
+{
+	atomic_dec(&hsspi->works.in_use);
+}
+
+void hsspi_hist_add(struct hsspi_hist *hist, s64 ns)
+{
+	u64 us = ns > 0 ? div_u64(ns, NSEC_PER_USEC) : 0;
+	int i = us ? ilog2(us) + 1 : 0;
+
+	atomic64_inc(&hist->count[min_t(int, i, ARRAY_SIZE(hist->count) - 1)]);
+}
+
+void hsspi_hist_reset(struct hsspi_hist *hist)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hist->count); i++)
+		atomic64_set(&hist->count[i], 0);
+}
+
+/**
+ * hsspi_latency() - account the duration of a phase
+ *
+ * @hsspi: &struct hsspi
+ * @ul: upper layer id
+ * @phase: &enum hsspi_phase
+ * @start: beginning of the phase
+ *
+ * Return: the duration of the phase in nanoseconds.
+ */
+static s64 hsspi_latency(struct hsspi *hsspi, u8 ul, enum hsspi_phase phase,
+			 ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (ul < UL_MAX_IDX)
+		hsspi_hist_add(&hsspi->latency[ul][phase], ns);
+
+	return ns;
+}
+
+/**
+ * hsspi_rec_add() - record a STC transaction in the flight recorder
+ *
+ * @hsspi: &struct hsspi
+ * @ret: status of the transaction
+ * @ss_ready_ns: ss_ready wait before the transaction
+ * @xfer_ns: duration of the transfer
+ * @retry: attempt number
+ *
+ * The STC headers are taken from &struct hsspi.host and &struct
+ * hsspi.soc. Lockless, can be called from any context.
+ */
+static void hsspi_rec_add(struct hsspi *hsspi, int ret, s64 ss_ready_ns,
+			  s64 xfer_ns, u8 retry)
+{
+	struct hsspi_rec *rec = &hsspi->rec;
+	struct hsspi_rec_entry *e;
+	u32 seq;
+
+	if (!rec->entries)
+		return;
+
+	/* 0 marks an entry being written */
+	seq = atomic_inc_return(&rec->seq);
+	if (!seq)
+		seq = atomic_inc_return(&rec->seq);
+
+	e = &rec->entries[seq & rec->mask];
+	WRITE_ONCE(e->seq, 0);
+	smp_wmb();
+
+	e->ts_ns = ktime_get_ns();
+	e->ret = ret;
+	e->ss_ready_ns = clamp_t(s64, ss_ready_ns, 0, U32_MAX);
+	e->xfer_ns = clamp_t(s64, xfer_ns, 0, U32_MAX);
+	e->host = *hsspi->host;
+	e->soc = *hsspi->soc;
+	e->retry = retry;
+
+	smp_wmb();
+	WRITE_ONCE(e->seq, seq);
+}
+
+/**
+ * hsspi_rec_get() - copy an entry of the flight recorder
+ *
+ * @rec: &struct hsspi_rec
+ * @seq: sequence number of the entry
+ * @e: destination
+ *
+ * Return: false if the entry was overwritten or is being written.
+ */
+static bool hsspi_rec_get(struct hsspi_rec *rec, u32 seq,
+			  struct hsspi_rec_entry *e)
+{
+	struct hsspi_rec_entry *src = &rec->entries[seq & rec->mask];
+
+	if (!seq || READ_ONCE(src->seq) != seq)
+		return false;
+
+	smp_rmb();
+	*e = *src;
+	smp_rmb();
+
+	return READ_ONCE(src->seq) == seq;
+}
+
+unsigned int hsspi_rec_snapshot(struct hsspi *hsspi,
+				struct hsspi_rec_entry *entries,
+				unsigned int len)
+{
+	struct hsspi_rec *rec = &hsspi->rec;
+	u32 last = atomic_read(&rec->seq);
+	unsigned int i, n = 0;
+
+	if (!rec->entries)
+		return 0;
+
+	for (i = min(len, rec->mask + 1); i > 0; i--)
+		if (hsspi_rec_get(rec, last - i + 1, &entries[n]))
+			n++;
+
+	return n;
+}
+
+/**
+ * hsspi_rec_dump() - print the flight recorder in the kernel logs
+ *
+ * @hsspi: &struct hsspi
+ */
+static void hsspi_rec_dump(struct hsspi *hsspi)
+{
+	struct hsspi_rec *rec = &hsspi->rec;
+	u32 last = atomic_read(&rec->seq);
+	struct hsspi_rec_entry e;
+	unsigned int i;
+
+	if (!rec->entries)
+		return;
+
+	dev_err(&hsspi->spi->dev, "last STC transactions:\n");
+	for (i = rec->mask + 1; i > 0; i--)
+		if (hsspi_rec_get(rec, last - i + 1, &e))
+			dev_err(&hsspi->spi->dev, HSSPI_REC_FMT "\n",
+				HSSPI_REC_ARG(&e));
+}
+
+static void hsspi_layer_sent(struct hsspi *hsspi, struct hsspi_layer *layer,
+			     struct hsspi_block *blk, int status)
+{
+	ktime_t start = ktime_get();
+
+	layer->ops->sent(layer, blk, status);
+	hsspi_latency(hsspi, layer->id, HSSPI_PHASE_CALLBACK, start);
+}
+
+static void hsspi_layer_received(struct hsspi *hsspi,
+				 struct hsspi_layer *layer,
+				 struct hsspi_block *blk, int status)
+{
+	ktime_t start = ktime_get();
+
+	layer->ops->received(layer, blk, status);
+	hsspi_latency(hsspi, layer->id, HSSPI_PHASE_CALLBACK, start);
+}
+
+/**
+ * hsspi_queue_works() - add a chain of works to a queue at once
+ *
+ * @q: &struct hsspi_queue
+ * @first: last work to dequeue, linked by node.next down to @last
+ * @last: first work to dequeue, its node.next is NULL
+ * @n: number of works in the chain
+ *
+ * Lockless, can be called concurrently from any context. No other work
+ * can be interleaved in the chain.
+ */
+static void hsspi_queue_works(struct hsspi_queue *q, struct hsspi_work *first,
+			      struct hsspi_work *last, int n)
+{
+	ktime_t now = ktime_get();
+	struct llist_node *node;
+
+	for (node = &first->node; node; node = node->next)
+		llist_entry(node, struct hsspi_work, node)->queued_at = now;
+
+	hsspi_atomic_max(&q->max_depth, atomic_add_return(n, &q->depth));
+
+	llist_add_batch(&first->node, &last->node, &q->queue);
+}
+
+/**
+ * hsspi_queue_work() - add a work to a queue
+ *
+ * @q: &struct hsspi_queue
+ * @hw: &struct hsspi_work
+ *
+ * Lockless, can be called concurrently from any context.
+ */
+static void hsspi_queue_work(struct hsspi_queue *q, struct hsspi_work *hw)
+{
+	hw->node.next = NULL;
+	hsspi_queue_works(q, hw, hw, 1);
+}
+
+static bool hsspi_queue_is_empty(struct hsspi_queue *q)
+{
+	return list_empty(&q->pending) && llist_empty(&q->queue);
+}
+
+static ktime_t hsspi_work_deadline(const struct hsspi_work *hw)
+{
+	if (hw->type == HSSPI_WORK_TX && hw->tx.blk->deadline)
+		return hw->tx.blk->deadline;
+
+	return KTIME_MAX;
+}
+
+/**
+ * hsspi_work_expired() - has a TX work missed its deadline
+ *
+ * @hw: &struct hsspi_work
+ *
+ * Return: True if the block has a deadline and it is in the past.
+ */
+static bool hsspi_work_expired(const struct hsspi_work *hw)
+{
+	ktime_t deadline = hsspi_work_deadline(hw);
+
+	return deadline != KTIME_MAX && ktime_after(ktime_get(), deadline);
+}
+
+/**
+ * hsspi_queue_add_pending() - insert a work in the pending list
+ *
+ * @q: &struct hsspi_queue
+ * @hw: &struct hsspi_work
+ *
+ * The pending list is kept sorted by deadline. Works with the same
+ * deadline, including all those without one, stay in FIFO order so the
+ * common case only appends at the tail.
+ */
+static void hsspi_queue_add_pending(struct hsspi_queue *q,
+				    struct hsspi_work *hw)
+{
+	ktime_t deadline = hsspi_work_deadline(hw);
+	struct hsspi_work *pos;
+
+	list_for_each_entry_reverse(pos, &q->pending, list) {
+		if (hsspi_work_deadline(pos) <= deadline)
+			break;
+	}
+	/* if no entry breaks the loop, pos->list is the list head */
+	list_add(&hw->list, &pos->list);
+}
+
+/**
+ * hsspi_queue_peek() - get the most urgent work of a queue
+ *
+ * @q: &struct hsspi_queue
+ *
+ * Must only be called by the HSSPI thread. The work is left in the
+ * queue.
+ *
+ * Return: a &struct hsspi_work or NULL if the queue is empty.
+ */
+static struct hsspi_work *hsspi_queue_peek(struct hsspi_queue *q)
+{
+	struct llist_node *batch, *n, *next;
+
+	/* llist_add() pushes in LIFO order, reverse the batch to get the
+	 * works in the order they were queued.
+	 */
+	batch = llist_reverse_order(llist_del_all(&q->queue));
+	llist_for_each_safe(n, next, batch)
+		hsspi_queue_add_pending(q,
+					llist_entry(n, struct hsspi_work, node));
+
+	return list_first_entry_or_null(&q->pending, struct hsspi_work, list);
+}
+
+/**
+ * hsspi_queue_pop() - take the most urgent work of a queue
+ *
+ * @hsspi: &struct hsspi
+ * @q: &struct hsspi_queue
+ *
+ * Must only be called by the HSSPI thread.
+ *
+ * Return: a &struct hsspi_work or NULL if the queue is empty.
+ */
+static struct hsspi_work *hsspi_queue_pop(struct hsspi *hsspi,
+					  struct hsspi_queue *q)
+{
+	struct hsspi_work *hw;
+	u64 wait_ns;
+
+	hw = hsspi_queue_peek(q);
+	if (!hw)
+		return NULL;
+
+	list_del(&hw->list);
+
+	atomic_dec(&q->depth);
+
+	wait_ns = ktime_to_ns(ktime_sub(ktime_get(), hw->queued_at));
+	q->dequeued++;
+	q->wait_ns += wait_ns;
+	if (wait_ns > q->max_wait_ns)
+		q->max_wait_ns = wait_ns;
+
+	if (hw->type == HSSPI_WORK_TX)
+		hsspi_hist_add(&hsspi->latency[hw->tx.layer->id]
+					      [HSSPI_PHASE_QUEUED],
+			       wait_ns);
+
+	return hw;
+}
+
+/**
+ * hsspi_pick_queue() - choose the queue to serve
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Pick the non-empty upper layer queue with the highest priority. A
+ * queue that has been passed over starvation_limit times wins over
+ * higher priority ones. The control queue is only picked when all
+ * the upper layer queues are empty.
+ *
+ * Return: a &struct hsspi_queue or NULL if there is nothing to do.
+ */
+static struct hsspi_queue *hsspi_pick_queue(struct hsspi *hsspi)
+{
+	u32 starvation_limit = READ_ONCE(hsspi->starvation_limit);
+	struct hsspi_queue *q, *best = NULL, *starving = NULL;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hsspi->queues); i++) {
+		q = &hsspi->queues[i];
+
+		if (hsspi_queue_is_empty(q))
+			continue;
+
+		if (!best || READ_ONCE(q->prio) < READ_ONCE(best->prio))
+			best = q;
+
+		if (q->skipped >= starvation_limit &&
+		    (!starving ||
+		     READ_ONCE(q->prio) < READ_ONCE(starving->prio)))
+			starving = q;
+	}
+
+	if (starving)
+		best = starving;
+
+	if (!best)
+		return hsspi_queue_is_empty(&hsspi->ctrl_queue) ?
+			       NULL :
+			       &hsspi->ctrl_queue;
+
+	for (i = 0; i < ARRAY_SIZE(hsspi->queues); i++) {
+		q = &hsspi->queues[i];
+
+		if (q == best)
+			q->skipped = 0;
+		else if (!hsspi_queue_is_empty(q))
+			q->skipped++;
+	}
+
+	return best;
+}
+
 /**
- * get_work() - get a work from the list
+ * get_work() - get a work from the queues
  *
  * @hsspi: &struct hsspi
  *
+ * Must only be called by the HSSPI thread.
+ *
  * Return: a &struct hsspi_work
  * The work can be:
  *  - a TX work enqueued by hsspi_send
@@ -83,16 +536,11 @@ static inline bool layer_id_is_valid(struct hsspi *hsspi, u8 ul)
  */
 static struct hsspi_work *get_work(struct hsspi *hsspi)
 {
+	struct hsspi_queue *q;
 	struct hsspi_work *hw;
 
-	spin_lock(&hsspi->lock);
-
-	hw = list_first_entry_or_null(&hsspi->work_list, struct hsspi_work,
-				      list);
-	if (hw)
-		list_del(&hw->list);
-
-	spin_unlock(&hsspi->lock);
+	q = hsspi_pick_queue(hsspi);
+	hw = q ? hsspi_queue_pop(hsspi, q) : NULL;
 
 	trace_hsspi_get_work(&hsspi->spi->dev, hw ? hw->type : -1);
 	return hw;
@@ -103,20 +551,21 @@ static struct hsspi_work *get_work(struct hsspi *hsspi)
  *
  * @hsspi: &struct hsspi
  *
+ * Must only be called by the HSSPI thread. It doesn't take any lock
+ * so that producers are never blocked by the thread polling.
+ *
  * Return: True if there is a TX work available or if the SS_IRQ flag
  * is set. False otherwise.
  */
 static bool is_txrx_waiting(struct hsspi *hsspi)
 {
-	enum hsspi_state state;
+	enum hsspi_state state = READ_ONCE(hsspi->state);
 	bool is_empty;
+	int i;
 
-	spin_lock(&hsspi->lock);
-
-	is_empty = list_empty(&hsspi->work_list);
-	state = hsspi->state;
-
-	spin_unlock(&hsspi->lock);
+	is_empty = hsspi_queue_is_empty(&hsspi->ctrl_queue);
+	for (i = 0; is_empty && i < ARRAY_SIZE(hsspi->queues); i++)
+		is_empty = hsspi_queue_is_empty(&hsspi->queues[i]);
 
 	trace_hsspi_is_txrx_waiting(&hsspi->spi->dev, is_empty, state);
 	/*
@@ -128,6 +577,139 @@ static bool is_txrx_waiting(struct hsspi *hsspi)
 			     test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags));
 }
 
+/**
+ * hsspi_gather() - collect the blocks to send in one frame
+ *
+ * @hsspi: &struct hsspi
+ * @hw: TX work taken from the queue
+ * @batch: list filled with the works to send, @hw first
+ * @can_wait: the caller may sleep waiting for more works
+ *
+ * If the layer of @hw allows it, the following TX works of its queue
+ * are added to @batch as long as the frame doesn't exceed
+ * HSSPI_MAX_FRAME_LEN. An expired work or a COMPLETION one ends the
+ * batch so that they are handled by the engine loop. When the queue
+ * is empty and @can_wait is set, wait for more works until
+ * coalesce_delay_us after @hw was queued, unless the QM35 has some
+ * data to output.
+ *
+ * Must only be called by the HSSPI thread or the asynchronous engine.
+ *
+ * Return: the length of the frame.
+ */
+static u16 hsspi_gather(struct hsspi *hsspi, struct hsspi_work *hw,
+			struct list_head *batch, bool can_wait)
+{
+	struct hsspi_layer *layer = hw->tx.layer;
+	struct hsspi_queue *q = &hsspi->queues[layer->id];
+	u16 length = hw->tx.blk->length;
+	struct hsspi_work *next;
+	ktime_t limit, now;
+
+	INIT_LIST_HEAD(batch);
+	list_add_tail(&hw->list, batch);
+
+	if (!layer->coalesce)
+		return length;
+
+	limit = ktime_add_us(hw->queued_at,
+			     READ_ONCE(hsspi->coalesce_delay_us));
+
+	while (1) {
+		next = hsspi_queue_peek(q);
+		if (!next) {
+			now = ktime_get();
+			if (!can_wait || !ktime_before(now, limit) ||
+			    test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
+				break;
+
+			wait_event_interruptible_hrtimeout(
+				hsspi->wq,
+				!hsspi_queue_is_empty(q) ||
+					test_bit(HSSPI_FLAGS_SS_IRQ,
+						 hsspi->flags) ||
+					kthread_should_stop(),
+				ktime_sub(limit, now));
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+
+		if (next->type != HSSPI_WORK_TX || hsspi_work_expired(next) ||
+		    length + next->tx.blk->length > HSSPI_MAX_FRAME_LEN)
+			break;
+
+		hsspi_queue_pop(hsspi, q);
+		list_add_tail(&next->list, batch);
+		length += next->tx.blk->length;
+		q->coalesced++;
+	}
+
+	return length;
+}
+
+/**
+ * hsspi_spin_ss_ready() - busy-poll ss_ready before sleeping
+ *
+ * @hsspi: &struct hsspi
+ *
+ * The ss_ready rising edge handler sets HSSPI_FLAGS_SS_READY from hard
+ * IRQ context, polling the flag rather than the GPIO keeps the
+ * handler and the thread in agreement about which edge was consumed.
+ *
+ * Return: true if ss_ready came up while spinning.
+ */
+static bool hsspi_spin_ss_ready(struct hsspi *hsspi)
+{
+	u64 max_ns = (u64)READ_ONCE(hsspi->ss_ready_spin_us) * NSEC_PER_USEC;
+	u64 avg_ns = hsspi->ss_ready_avg_ns;
+	ktime_t start, end;
+	bool ready;
+
+	/* not worth it if ss_ready usually takes longer */
+	if (!max_ns || !avg_ns || avg_ns > max_ns)
+		return false;
+
+	start = ktime_get();
+	end = ktime_add_ns(start, min(2 * avg_ns, max_ns));
+	do {
+		ready = test_and_clear_bit(HSSPI_FLAGS_SS_READY, hsspi->flags);
+		if (ready)
+			break;
+		cpu_relax();
+	} while (ktime_before(ktime_get(), end));
+
+	hsspi->ss_ready_stats.spin_ns += ktime_to_ns(ktime_sub(ktime_get(),
+							       start));
+	return ready;
+}
+
+/**
+ * hsspi_ss_ready_latency() - account a ss_ready latency
+ *
+ * @hsspi: &struct hsspi
+ * @start: beginning of the wait
+ * @spun: the wait ended while spinning
+ */
+static void hsspi_ss_ready_latency(struct hsspi *hsspi, ktime_t start,
+				   bool spun)
+{
+	struct hsspi_ss_ready_stats *stats = &hsspi->ss_ready_stats;
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	u64 avg_ns = hsspi->ss_ready_avg_ns;
+
+	/* exponential moving average, weight of 1/8 */
+	hsspi->ss_ready_avg_ns = avg_ns - (avg_ns >> 3) + ((u64)ns >> 3);
+
+	if (spun) {
+		stats->spun++;
+		hsspi_hist_add(&stats->spin_hist, ns);
+	} else {
+		stats->slept++;
+		hsspi_hist_add(&stats->sleep_hist, ns);
+	}
+}
+
 /**
  * hsspi_wait_ss_ready() - waits for ss_ready to be up
  *
@@ -137,6 +719,8 @@ static bool is_txrx_waiting(struct hsspi *hsspi)
  */
 static int hsspi_wait_ss_ready(struct hsspi *hsspi)
 {
+	ktime_t start;
+	bool spun;
 	int ret;
 
 	hsspi->waiting_ss_rdy = true;
@@ -158,10 +742,15 @@ static int hsspi_wait_ss_ready(struct hsspi *hsspi)
 		hsspi->wakeup(hsspi);
 	}
 
-	ret = wait_event_interruptible_timeout(
-		hsspi->wq_ready,
-		test_and_clear_bit(HSSPI_FLAGS_SS_READY, hsspi->flags),
-		msecs_to_jiffies(SS_READY_TIMEOUT_MS));
+	start = ktime_get();
+	spun = hsspi_spin_ss_ready(hsspi);
+	if (spun)
+		ret = 1;
+	else
+		ret = wait_event_interruptible_timeout(
+			hsspi->wq_ready,
+			test_and_clear_bit(HSSPI_FLAGS_SS_READY, hsspi->flags),
+			msecs_to_jiffies(SS_READY_TIMEOUT_MS));
 	if (ret == 0) {
 		dev_warn(&hsspi->spi->dev,
 			 "timed out waiting for ss_ready(%d)\n",
@@ -173,6 +762,7 @@ static int hsspi_wait_ss_ready(struct hsspi *hsspi)
 			"Error %d while waiting for ss_ready\n", ret);
 		return ret;
 	}
+	hsspi_ss_ready_latency(hsspi, start, spun);
 	/* WA: QM35 C0 have a very short (<100ns) ss_ready toggle
 	 * in the ROM code when waking up from S4. If we transfer immediately,
 	 * the ROM code will enter its command mode and we'll end up
@@ -200,37 +790,403 @@ int hsspi_set_cs_level(struct spi_device *spi, int level)
 #endif
 
 /**
- * spi_xfer() - Single SPI transfer
+ * hsspi_speed() - get the SPI clock of a transfer
  *
  * @hsspi: &struct hsspi
- * @tx: tx payload
- * @rx: rx payload
- * @length: payload length
+ * @phase: &enum hsspi_clk_phase
+ *
+ * Return: the clock for the upper layer of the current STC host header,
+ * 0 for the default one.
  */
-static int spi_xfer(struct hsspi *hsspi, const void *tx, void *rx,
-		    size_t length)
+static u32 hsspi_speed(struct hsspi *hsspi, enum hsspi_clk_phase phase)
 {
-	struct spi_transfer xfers[2] = {
-		{
-			.tx_buf = hsspi->host,
-			.rx_buf = hsspi->soc,
-			.len = sizeof(*(hsspi->host)),
-		},
-		{
-			.tx_buf = tx,
-			.rx_buf = rx,
-			.len = length,
-		},
-	};
-	int ret, retry = 5;
+	u8 ul = hsspi->host->ul;
+
+	return ul < UL_MAX_IDX ? READ_ONCE(hsspi->speed_hz[ul][phase]) : 0;
+}
+
+/**
+ * hsspi_msg_clock_ns() - time spent clocking the bits of a message
+ *
+ * @hsspi: &struct hsspi
+ * @msg: the message
+ * @len: incremented by the length of the message
+ *
+ * Return: the clocking time in ns.
+ */
+static u64 hsspi_msg_clock_ns(struct hsspi *hsspi, struct spi_message *msg,
+			      size_t *len)
+{
+	struct spi_transfer *xfer;
+	u64 clock_ns = 0;
+	u32 speed_hz;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		speed_hz = xfer->speed_hz ?: hsspi->spi->max_speed_hz;
+		if (speed_hz)
+			clock_ns += div_u64((u64)xfer->len * 8 * NSEC_PER_SEC,
+					    speed_hz);
+		*len += xfer->len;
+	}
+
+	return clock_ns;
+}
+
+/**
+ * hsspi_xfer_account() - account a STC transaction
+ *
+ * @hsspi: &struct hsspi
+ * @layout: &enum hsspi_layout of the transaction
+ * @ns: duration of the transaction
+ * @clock_ns: time spent clocking its bits
+ */
+static void hsspi_xfer_account(struct hsspi *hsspi, enum hsspi_layout layout,
+			       s64 ns, u64 clock_ns)
+{
+	struct hsspi_xfer_stats *stats = &hsspi->xfer_stats[layout];
+
+	ns = max_t(s64, ns - clock_ns, 0);
+	stats->frames++;
+	stats->overhead_ns += ns;
+	if (ns > stats->max_overhead_ns)
+		stats->max_overhead_ns = ns;
+}
+
+/**
+ * hsspi_throughput_add() - account the payload of an upper layer
+ *
+ * @hsspi: &struct hsspi
+ * @ul: upper layer id
+ * @rx: received, not sent
+ * @len: number of bytes
+ * @ns: time taken
+ */
+static void hsspi_throughput_add(struct hsspi *hsspi, u8 ul, bool rx,
+				 size_t len, s64 ns)
+{
+	struct hsspi_throughput *tp;
+
+	if (ul >= UL_MAX_IDX)
+		return;
+
+	tp = &hsspi->throughput[ul][rx];
+	tp->bytes += len;
+	tp->ns += ns;
+}
+
+/**
+ * hsspi_duplex_enabled() - check if a write can also read the SoC output
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Return: true if full-duplex writes are forced, or if they are enabled
+ * and neither the controller nor the firmware were found not to support
+ * them.
+ */
+static bool hsspi_duplex_enabled(struct hsspi *hsspi)
+{
+	switch (READ_ONCE(hsspi->full_duplex)) {
+	case HSSPI_DUPLEX_FORCE:
+		return true;
+	case HSSPI_DUPLEX_AUTO:
+		return hsspi->duplex_ctlr &&
+		       !test_bit(HSSPI_FLAGS_DUPLEX_NO_FW, hsspi->flags);
+	default:
+		return false;
+	}
+}
+
+/**
+ * hsspi_duplex_probe() - learn if the firmware supports full-duplex writes
+ *
+ * @hsspi: &struct hsspi
+ * @soc_flags: flags of the SoC header answering a STC_HOST_RD write
+ *
+ * STC_SOC_OA tells that the firmware supports them. A firmware which
+ * keeps announcing some output without acknowledging the read during
+ * HSSPI_DUPLEX_PROBES writes is assumed not to. Both are forgotten by
+ * hsspi_start().
+ */
+static void hsspi_duplex_probe(struct hsspi *hsspi, u8 soc_flags)
+{
+	if (soc_flags & STC_SOC_OA) {
+		hsspi->duplex_misses = 0;
+		if (!test_and_set_bit(HSSPI_FLAGS_DUPLEX_FW, hsspi->flags))
+			dev_info(&hsspi->spi->dev,
+				 "firmware supports full-duplex writes\n");
+		return;
+	}
+
+	if (!(soc_flags & STC_SOC_ODW) ||
+	    test_bit(HSSPI_FLAGS_DUPLEX_FW, hsspi->flags) ||
+	    test_bit(HSSPI_FLAGS_DUPLEX_NO_FW, hsspi->flags))
+		return;
+
+	if (++hsspi->duplex_misses >= HSSPI_DUPLEX_PROBES) {
+		set_bit(HSSPI_FLAGS_DUPLEX_NO_FW, hsspi->flags);
+		dev_info(&hsspi->spi->dev,
+			 "firmware doesn't support full-duplex writes\n");
+	}
+}
+
+/**
+ * hsspi_duplex_transfer() - write transaction also reading the SoC output
+ *
+ * @hsspi: &struct hsspi
+ * @tx: tx payload
+ * @length: tx payload length
+ *
+ * The STC headers are exchanged first while CS is kept active. If the
+ * SoC acknowledges the read with STC_SOC_OA, the data phase also clocks
+ * in the frame announced in its header into &struct hsspi.rx_frame. It
+ * is handed to its upper layer by hsspi_duplex_received(), once the bus
+ * is released, so that nothing is allocated while CS is active.
+ *
+ * Return: 0 or the error of the SPI transfers.
+ */
+static int hsspi_duplex_transfer(struct hsspi *hsspi, const void *tx,
+				 size_t length)
+{
+	struct spi_transfer hdr = {
+		.tx_buf = hsspi->host,
+		.rx_buf = hsspi->soc,
+		.len = sizeof(*(hsspi->host)),
+		.speed_hz = hsspi_speed(hsspi, HSSPI_CLK_HEADER),
+		/* keep CS active for the data phase */
+		.cs_change = 1,
+	};
+	struct spi_transfer data[2] = {};
+	struct spi_controller *ctlr = hsspi->spi->controller;
+	void *rx = hsspi->rx_frame;
+	size_t rx_length = 0, common, len = 0;
+	struct spi_message msg;
+	ktime_t start;
+	u64 clock_ns;
+	u8 soc_flags;
+	int ret;
+	s64 ns;
+
+	hsspi->duplex_rx.done = false;
+
+	spi_bus_lock(ctlr);
+
+	start = ktime_get();
+	spi_message_init_with_transfers(&msg, &hdr, 1);
+	ret = spi_sync_locked(hsspi->spi, &msg);
+	if (ret)
+		goto unlock;
+	clock_ns = hsspi_msg_clock_ns(hsspi, &msg, &len);
+
+	soc_flags = hsspi->soc->flags;
+	if ((soc_flags & STC_SOC_RDY) && !(soc_flags & 0x0f)) {
+		hsspi_duplex_probe(hsspi, soc_flags);
+		if (soc_flags & STC_SOC_OA)
+			rx_length = hsspi->soc->length;
+		if (rx_length > HSSPI_MAX_FRAME_LEN) {
+			dev_warn(&hsspi->spi->dev,
+				 "%s: bad soc length %zu\n", __func__,
+				 rx_length);
+			rx_length = 0;
+		}
+	}
+
+	common = min(length, rx_length);
+	data[0].speed_hz = data[1].speed_hz = hsspi_speed(hsspi, HSSPI_CLK_TX);
+	data[0].tx_buf = tx;
+	data[0].rx_buf = rx;
+	data[0].len = common;
+	if (length > common) {
+		data[1].tx_buf = tx + common;
+		data[1].len = length - common;
+	} else {
+		data[1].rx_buf = rx + common;
+		data[1].len = rx_length - common;
+	}
+
+	spi_message_init_with_transfers(&msg, data, ARRAY_SIZE(data));
+	ret = spi_sync_locked(hsspi->spi, &msg);
+
+	hsspi->duplex_rx.ul = hsspi->soc->ul;
+	hsspi->duplex_rx.length = rx_length;
+	hsspi->duplex_rx.done = !ret && rx_length;
+
+	/* both messages are one transaction, the read rides along */
+	if (!ret) {
+		clock_ns += hsspi_msg_clock_ns(hsspi, &msg, &len);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		hsspi_throughput_add(hsspi, hsspi->host->ul, false,
+				     sizeof(*(hsspi->host)) + length, ns);
+		if (rx_length)
+			hsspi_throughput_add(hsspi, hsspi->soc->ul, true,
+					     rx_length, ns);
+		hsspi_xfer_account(hsspi, HSSPI_LAYOUT_DUPLEX, ns, clock_ns);
+	}
+
+unlock:
+	spi_bus_unlock(ctlr);
+	return ret;
+}
+
+/**
+ * hsspi_fill_xfers() - describe a STC transaction
+ *
+ * @hsspi: &struct hsspi
+ * @xfers: the two transfers to fill
+ * @tx: tx payload
+ * @rx: rx payload
+ * @length: payload length
+ * @headroom: the payload buffer has HSSPI_HEADROOM bytes before it
+ *
+ * By default the STC headers and the payload are two transfers. In
+ * contiguous mode, when the payload buffer has some headroom, the host
+ * header is copied in front of it and the whole frame is a single
+ * transfer. The other direction then uses &struct hsspi.tx_frame or
+ * &struct hsspi.rx_frame.
+ *
+ * Return: the number of transfers to use.
+ */
+static int hsspi_fill_xfers(struct hsspi *hsspi, struct spi_transfer *xfers,
+			    const void *tx, void *rx, size_t length,
+			    bool headroom)
+{
+	u8 *tx_buf, *rx_buf;
+
+	memset(xfers, 0, 2 * sizeof(*xfers));
+
+	if (headroom && length && READ_ONCE(hsspi->contiguous) &&
+	    HSSPI_HEADROOM + length <= MAX_STC_FRAME_LEN) {
+		if (tx) {
+			tx_buf = (u8 *)tx - HSSPI_HEADROOM;
+		} else {
+			tx_buf = hsspi->tx_frame;
+			memset(tx_buf + HSSPI_HEADROOM, 0, length);
+		}
+		memcpy(tx_buf, hsspi->host, sizeof(*(hsspi->host)));
+
+		rx_buf = rx ? (u8 *)rx - HSSPI_HEADROOM : hsspi->rx_frame;
+
+		xfers[0].tx_buf = tx_buf;
+		xfers[0].rx_buf = rx_buf;
+		xfers[0].len = HSSPI_HEADROOM + length;
+		xfers[0].speed_hz =
+			hsspi_speed(hsspi, tx ? HSSPI_CLK_TX : HSSPI_CLK_RX);
+		return 1;
+	}
+
+	xfers[0].tx_buf = hsspi->host;
+	xfers[0].rx_buf = hsspi->soc;
+	xfers[0].len = sizeof(*(hsspi->host));
+	xfers[0].speed_hz = hsspi_speed(hsspi, HSSPI_CLK_HEADER);
+	xfers[1].tx_buf = tx;
+	xfers[1].rx_buf = rx;
+	xfers[1].len = length;
+	xfers[1].speed_hz =
+		hsspi_speed(hsspi, tx ? HSSPI_CLK_TX : HSSPI_CLK_RX);
+	return length ? 2 : 1;
+}
+
+/**
+ * hsspi_msg() - get the SPI message of a STC transaction
+ *
+ * @hsspi: &struct hsspi
+ * @tx: tx payload
+ * @rx: rx payload
+ * @length: payload length
+ * @headroom: see hsspi_fill_xfers()
+ *
+ * Header only transactions use &struct hsspi.hdr_msg which never
+ * changes and is optimized once for all by hsspi_init(). For the
+ * others, &struct hsspi.frame_msg is rebuilt and validated by the SPI
+ * core at each transaction: an optimized message must keep its buffers
+ * and lengths.
+ *
+ * Return: the message to submit.
+ */
+static struct spi_message *hsspi_msg(struct hsspi *hsspi, const void *tx,
+				     void *rx, size_t length, bool headroom)
+{
+	int n;
+
+	if (!length)
+		return &hsspi->hdr_msg;
+
+	n = hsspi_fill_xfers(hsspi, hsspi->frame_xfers, tx, rx, length,
+			     headroom);
+	spi_message_init_with_transfers(&hsspi->frame_msg, hsspi->frame_xfers,
+					n);
+	return &hsspi->frame_msg;
+}
+
+/**
+ * hsspi_msg_done() - finish a message returned by hsspi_msg()
+ *
+ * @hsspi: &struct hsspi
+ * @msg: the message
+ * @start: time at which the message was submitted
+ * @ret: status of the message
+ *
+ * Copies the SoC header received in a contiguous frame and accounts
+ * the controller overhead, the time not spent clocking bits, and the
+ * throughput of the upper layer.
+ */
+static void hsspi_msg_done(struct hsspi *hsspi, struct spi_message *msg,
+			   ktime_t start, int ret)
+{
+	struct spi_transfer *xfer =
+		list_first_entry(&msg->transfers, struct spi_transfer,
+				 transfer_list);
+	bool contiguous = xfer->rx_buf != hsspi->soc;
+	size_t len = 0;
+	u64 clock_ns;
+	s64 ns;
+
+	if (ret)
+		return;
+
+	if (contiguous)
+		memcpy(hsspi->soc, xfer->rx_buf, sizeof(*(hsspi->soc)));
+
+	clock_ns = hsspi_msg_clock_ns(hsspi, msg, &len);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	hsspi_throughput_add(hsspi, hsspi->host->ul,
+			     !(hsspi->host->flags & STC_HOST_WR), len, ns);
+	hsspi_xfer_account(hsspi,
+			   contiguous ? HSSPI_LAYOUT_CONTIGUOUS :
+					HSSPI_LAYOUT_SPLIT,
+			   ns, clock_ns);
+}
+
+/**
+ * spi_xfer() - Single SPI transfer
+ *
+ * @hsspi: &struct hsspi
+ * @tx: tx payload
+ * @rx: rx payload
+ * @length: payload length
+ * @flags: HSSPI_XFER_DUPLEX to use hsspi_duplex_transfer(), @rx must
+ * then be NULL. HSSPI_XFER_HEADROOM if the payload buffer has some
+ * headroom for hsspi_fill_xfers().
+ */
+static int spi_xfer(struct hsspi *hsspi, const void *tx, void *rx,
+		    size_t length, unsigned int flags)
+{
+	struct spi_message *msg;
+	s64 wait_ns, xfer_ns;
+	ktime_t start;
+	int ret, retry = 5;
+	u8 ul = hsspi->host->ul;
 
 	hsspi->soc->flags = 0;
 	hsspi->soc->ul = 0;
 	hsspi->soc->length = 0;
 
 	do {
+		start = ktime_get();
 		ret = hsspi_wait_ss_ready(hsspi);
+		wait_ns = hsspi_latency(hsspi, ul, HSSPI_PHASE_SS_READY, start);
 		if (ret < 0) {
+			hsspi_rec_add(hsspi, ret, wait_ns, 0, 5 - retry);
 			continue;
 		}
 
@@ -243,14 +1199,23 @@ static int spi_xfer(struct hsspi *hsspi, const void *tx, void *rx,
 		hsspi_set_cs_level(hsspi->spi, 0);
 		udelay(HSSPI_MANUAL_CS_SETUP_US);
 #endif
-		ret = spi_sync_transfer(hsspi->spi, xfers, length ? 2 : 1);
+		start = ktime_get();
+		if (flags & HSSPI_XFER_DUPLEX) {
+			ret = hsspi_duplex_transfer(hsspi, tx, length);
+		} else {
+			msg = hsspi_msg(hsspi, tx, rx, length,
+					flags & HSSPI_XFER_HEADROOM);
+			ret = spi_sync(hsspi->spi, msg);
+			hsspi_msg_done(hsspi, msg, start, ret);
+		}
+		xfer_ns = hsspi_latency(hsspi, ul, HSSPI_PHASE_XFER, start);
 
 		trace_hsspi_spi_xfer(&hsspi->spi->dev, hsspi->host, hsspi->soc,
 				     ret);
+		hsspi_rec_add(hsspi, ret, wait_ns, xfer_ns, 5 - retry);
 
 		if (ret) {
-			dev_err(&hsspi->spi->dev, "spi_sync_transfer: %d\n",
-				ret);
+			dev_err(&hsspi->spi->dev, "spi_sync: %d\n", ret);
 			continue;
 		}
 
@@ -290,6 +1255,41 @@ static bool check_soc_flag(const struct device *dev, const char *func_name,
 	return res;
 }
 
+/**
+ * hsspi_rx_check() - check the SoC header of a RX transaction
+ *
+ * @hsspi: &struct hsspi
+ * @ul: upper layer id requested
+ * @length: length requested
+ *
+ * Also re-enables SS_IRQ if the QM35 has no more output waiting.
+ *
+ * Return: 0 or -1 if the SoC header is not the expected one.
+ */
+static int hsspi_rx_check(struct hsspi *hsspi, u8 ul, u16 length)
+{
+	int ret = 0;
+
+	if (!check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags,
+			    false)) {
+		ret = -1;
+	}
+
+	if ((hsspi->soc->ul != ul) || (hsspi->soc->length != length)) {
+		dev_warn(&hsspi->spi->dev,
+			 "%s: received %hhu %hu but expecting %hhu %hu\n",
+			 __func__, hsspi->soc->ul, hsspi->soc->length, ul,
+			 length);
+		ret = -1;
+	}
+
+	if (!(hsspi->soc->flags & STC_SOC_ODW) &&
+	    test_and_clear_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
+		hsspi->odw_cleared(hsspi);
+
+	return ret;
+}
+
 /**
  * hsspi_rx() - request data from the QM35 on the HSSPI
  *
@@ -307,126 +1307,831 @@ static int hsspi_rx(struct hsspi *hsspi, u8 ul, u16 length)
 	hsspi->host->ul = ul;
 	hsspi->host->length = length;
 
-	if (layer_id_is_valid(hsspi, ul)) {
-		spin_lock(&hsspi->lock);
-		layer = hsspi->layers[ul];
-		spin_unlock(&hsspi->lock);
-	} else
-		layer = NULL;
+	layer = hsspi_get_layer(hsspi, ul);
 
-	blk = layer ? layer->ops->get(layer, length) : NULL;
+	blk = layer ? layer->ops->get(layer, length, GFP_KERNEL) : NULL;
 	if (blk) {
-		ret = spi_xfer(hsspi, NULL, blk->data, blk->size);
+		ret = spi_xfer(hsspi, NULL, blk->data, blk->size,
+			       blk->headroom >= HSSPI_HEADROOM ?
+				       HSSPI_XFER_HEADROOM :
+				       0);
 
-		layer->ops->received(layer, blk, ret);
+		hsspi_layer_received(hsspi, layer, blk, ret);
 	} else
-		ret = spi_xfer(hsspi, NULL, NULL, 0);
+		ret = spi_xfer(hsspi, NULL, NULL, 0, 0);
 
 	if (ret)
 		return ret;
 
-	if (!check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags,
-			    false)) {
-		ret = -1;
+	return hsspi_rx_check(hsspi, ul, length);
+}
+
+/**
+ * hsspi_duplex_received() - deliver the output read during a write
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Same as the end of hsspi_rx() for a frame read by
+ * hsspi_duplex_transfer(), which is copied into a block of its upper
+ * layer. The SoC header was received before the data phase, its
+ * STC_SOC_ODW flag tells if more output remains.
+ */
+static void hsspi_duplex_received(struct hsspi *hsspi)
+{
+	u16 length = hsspi->duplex_rx.length;
+	u8 ul = hsspi->duplex_rx.ul;
+	struct hsspi_layer *layer;
+	struct hsspi_block *blk;
+
+	hsspi->duplex_rx.done = false;
+
+	layer = hsspi_get_layer(hsspi, ul);
+	blk = layer ? layer->ops->get(layer, length, GFP_KERNEL) : NULL;
+	if (blk) {
+		memcpy(blk->data, hsspi->rx_frame, length);
+		hsspi_layer_received(hsspi, layer, blk, 0);
+	} else
+		dev_warn(&hsspi->spi->dev, "%s: %hu bytes dropped on ul %hhu\n",
+			 __func__, length, ul);
+
+	hsspi->duplex_merged++;
+
+	if (!(hsspi->soc->flags & STC_SOC_ODW) &&
+	    test_and_clear_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
+		hsspi->odw_cleared(hsspi);
+}
+
+/**
+ * hsspi_frame() - get the payload of a TX batch
+ *
+ * @hsspi: &struct hsspi
+ * @batch: list of TX works built by hsspi_gather()
+ * @size: set to the number of bytes to transfer
+ * @headroom: set if the data has some headroom for the STC header
+ *
+ * A single block is sent from its own memory, several ones are
+ * concatenated in &struct hsspi.tx_frame, after its headroom.
+ *
+ * Return: the data to transfer.
+ */
+static void *hsspi_frame(struct hsspi *hsspi, struct list_head *batch,
+			 u16 *size, bool *headroom)
+{
+	struct hsspi_work *hw;
+	struct hsspi_block *blk;
+	u8 *frame = hsspi->tx_frame + HSSPI_HEADROOM;
+
+	if (list_is_singular(batch)) {
+		blk = list_first_entry(batch, struct hsspi_work, list)->tx.blk;
+		*size = blk->size;
+		*headroom = blk->headroom >= HSSPI_HEADROOM;
+		return blk->data;
 	}
 
-	if ((hsspi->soc->ul != ul) || (hsspi->soc->length != length)) {
-		dev_warn(&hsspi->spi->dev,
-			 "%s: received %hhu %hu but expecting %hhu %hu\n",
-			 __func__, hsspi->soc->ul, hsspi->soc->length, ul,
-			 length);
-		ret = -1;
+	*size = 0;
+	list_for_each_entry(hw, batch, list) {
+		blk = hw->tx.blk;
+		memcpy(frame + *size, blk->data, blk->length);
+		*size += blk->length;
+	}
+	*headroom = true;
+	return frame;
+}
+
+/**
+ * hsspi_tx() - send hsspi blocks to the QM35 on the HSSPI
+ *
+ * @hsspi: &struct hsspi
+ * @layer: &struct hsspi_layer
+ * @batch: list of TX works built by hsspi_gather()
+ * @length: length of the frame returned by hsspi_gather()
+ *
+ * Each block is given back to the layer with the status of the
+ * transfer.
+ *
+ * It also adds PRD flag if SS_IRQ is set. Therefore it will try a RX
+ * transfer accordingly. In full-duplex mode, the RD flag is added too
+ * so that the SoC can output its frame in the same transaction.
+ */
+static int hsspi_tx(struct hsspi *hsspi, struct hsspi_layer *layer,
+		    struct list_head *batch, u16 length)
+{
+	unsigned int flags = 0;
+	struct hsspi_work *hw;
+	bool duplex = false;
+	bool headroom;
+	void *data;
+	u16 size;
+	int ret;
+
+	data = hsspi_frame(hsspi, batch, &size, &headroom);
+
+	hsspi->host->flags = STC_HOST_WR;
+	hsspi->host->ul = layer->id;
+	hsspi->host->length = length;
+
+	if (test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags)) {
+		hsspi->host->flags |= STC_HOST_PRD;
+
+		duplex = hsspi_duplex_enabled(hsspi);
+		if (duplex)
+			hsspi->host->flags |= STC_HOST_RD;
+	}
+
+	if (duplex)
+		flags |= HSSPI_XFER_DUPLEX;
+	else if (headroom)
+		flags |= HSSPI_XFER_HEADROOM;
+
+	ret = spi_xfer(hsspi, data, NULL, size, flags);
+
+	list_for_each_entry(hw, batch, list)
+		hsspi_layer_sent(hsspi, layer, hw->tx.blk, ret);
+
+	if (ret)
+		return ret;
+
+	if (hsspi->duplex_rx.done) {
+		hsspi_duplex_received(hsspi);
+		return 0;
+	}
+
+	/* Ignore tx check flags */
+	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+
+	if (hsspi->host->flags & STC_HOST_PRD)
+		return hsspi_rx(hsspi, hsspi->soc->ul, hsspi->soc->length);
+
+	return ret;
+}
+
+/**
+ * hsspi_pre_read() - send a PRE_READ with no TX and do RX
+ *
+ * @hsspi: &struct hsspi
+ *
+ * This function is a particular case of hsspi_tx with no layer or
+ * blk.
+ *
+ */
+static int hsspi_pre_read(struct hsspi *hsspi)
+{
+	int ret;
+
+	hsspi->host->flags = STC_HOST_PRD;
+	hsspi->host->ul = 0;
+	hsspi->host->length = 0;
+
+	ret = spi_xfer(hsspi, NULL, NULL, 0, 0);
+	if (ret)
+		return ret;
+
+	/* Ignore pre-read check flags */
+	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+
+	return hsspi_rx(hsspi, hsspi->soc->ul, hsspi->soc->length);
+}
+
+/**
+ * hsspi_batch_free() - give back the works of a TX batch
+ *
+ * @hsspi: &struct hsspi
+ * @batch: list of TX works built by hsspi_gather()
+ */
+static void hsspi_batch_free(struct hsspi *hsspi, struct list_head *batch)
+{
+	struct hsspi_work *hw, *tmp;
+
+	list_for_each_entry_safe(hw, tmp, batch, list)
+		hsspi_work_put(hsspi);
+
+	INIT_LIST_HEAD(batch);
+}
+
+/**
+ * hsspi_work_drop() - give back an expired TX work
+ *
+ * @hsspi: &struct hsspi
+ * @hw: &struct hsspi_work
+ */
+static void hsspi_work_drop(struct hsspi *hsspi, struct hsspi_work *hw)
+{
+	/* too late, don't waste the bus */
+	hsspi->queues[hw->tx.layer->id].expired++;
+	hsspi_layer_sent(hsspi, hw->tx.layer, hw->tx.blk, -ETIME);
+	hsspi_work_put(hsspi);
+}
+
+/**
+ * hsspi_count_error() - account the status of a transaction
+ *
+ * @hsspi: &struct hsspi
+ * @ret: status of the transaction
+ *
+ * Return: True if the QM35 must be reset.
+ */
+static bool hsspi_count_error(struct hsspi *hsspi, int ret)
+{
+	if (!ret) {
+		hsspi->successive_errors = 0;
+		return false;
+	}
+
+	if (++hsspi->successive_errors <= MAX_SUCCESSIVE_ERRORS)
+		return false;
+
+	hsspi->successive_errors = 0;
+	return true;
+}
+
+/**
+ * hsspi_error_reset() - reset the QM35 after too many errors
+ *
+ * @hsspi: &struct hsspi
+ *
+ * HSSPI thread only, the flight recorder dump is too long for atomic
+ * context.
+ */
+static void hsspi_error_reset(struct hsspi *hsspi)
+{
+	dev_err(&hsspi->spi->dev,
+		"Max successive errors %d reached, likely entered ROM code...\n",
+		MAX_SUCCESSIVE_ERRORS);
+	hsspi_rec_dump(hsspi);
+
+	hsspi->error_resets++;
+	hsspi->reset_qm35(hsspi);
+}
+
+/**
+ * hsspi_process() - handle a work in the HSSPI thread
+ *
+ * @hsspi: &struct hsspi
+ * @hw: &struct hsspi_work or NULL to do a PRE_READ
+ *
+ * Return: the status of the transaction or 1 if nothing was
+ * transferred.
+ */
+static int hsspi_process(struct hsspi *hsspi, struct hsspi_work *hw)
+{
+	LIST_HEAD(batch);
+	u16 length;
+	int ret;
+
+	/* If there is no work, we are here because SS_IRQ is set. */
+	if (!hw)
+		return hsspi_pre_read(hsspi);
+
+	switch (hw->type) {
+	case HSSPI_WORK_COMPLETION:
+		complete(hw->completion);
+		/* on the stack no need to free */
+		return 1;
+	case HSSPI_WORK_TX:
+		if (hsspi_work_expired(hw)) {
+			hsspi_work_drop(hsspi, hw);
+			return 1;
+		}
+
+		length = hsspi_gather(hsspi, hw, &batch, true);
+		ret = hsspi_tx(hsspi, hw->tx.layer, &batch, length);
+		hsspi_batch_free(hsspi, &batch);
+		return ret;
+	default:
+		dev_err(&hsspi->spi->dev, "unknown hsspi_work type: %d\n",
+			hw->type);
+		return 1;
 	}
+}
+
+/**
+ * hsspi_async_fallback() - hand the engine over to the HSSPI thread
+ *
+ * @hsspi: &struct hsspi
+ *
+ * The thread does the job left in &struct hsspi.async with the
+ * blocking primitives then gives the engine back.
+ *
+ * Return: True, the engine is still owned.
+ */
+static bool hsspi_async_fallback(struct hsspi *hsspi)
+{
+	hsspi->async.fallbacks++;
+	hsspi->async.wait_start = 0;
+
+	set_bit(HSSPI_FLAGS_FALLBACK, hsspi->flags);
+	wake_up_interruptible(&hsspi->wq);
+	return true;
+}
+
+/**
+ * hsspi_async_failed() - prepare a failed transaction for a retry
+ *
+ * @hsspi: &struct hsspi
+ *
+ * A TX batch stays in &struct hsspi_async.batch, a RX block is given
+ * back to its layer but the RX transaction stays pending.
+ */
+static void hsspi_async_failed(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+
+	if (as->phase == HSSPI_ASYNC_RX && as->rx_blk)
+		hsspi_layer_received(hsspi, as->rx_layer, as->rx_blk,
+				     -EAGAIN);
+
+	as->rx_layer = NULL;
+	as->rx_blk = NULL;
+}
+
+static void hsspi_async_complete(void *context);
+
+/**
+ * hsspi_async_xfer() - start an asynchronous STC transaction
+ *
+ * @hsspi: &struct hsspi
+ * @phase: &enum hsspi_async_phase
+ * @tx: tx payload
+ * @rx: rx payload
+ * @length: payload length
+ * @headroom: the payload buffer has some headroom, see
+ * hsspi_fill_xfers()
+ *
+ * The engine shares the messages of hsspi_msg() with the HSSPI thread,
+ * its owner is the only one using them.
+ *
+ * Return: True, the engine is still owned.
+ */
+static bool hsspi_async_xfer(struct hsspi *hsspi,
+			     enum hsspi_async_phase phase, const void *tx,
+			     void *rx, size_t length, bool headroom)
+{
+	struct hsspi_async *as = &hsspi->async;
+	int ret;
+
+	del_timer(&as->timer);
+	hsspi->waiting_ss_rdy = false;
+
+	as->wait_ns = 0;
+	if (as->wait_start) {
+		as->wait_ns = hsspi_latency(hsspi, hsspi->host->ul,
+					    HSSPI_PHASE_SS_READY,
+					    as->wait_start);
+		as->wait_start = 0;
+	}
+
+	hsspi->soc->flags = 0;
+	hsspi->soc->ul = 0;
+	hsspi->soc->length = 0;
+
+	as->msg = hsspi_msg(hsspi, tx, rx, length, headroom);
+	as->msg->complete = hsspi_async_complete;
+	as->msg->context = hsspi;
+	as->phase = phase;
+	as->xfers_count++;
+
+	hsspi_set_spi_slave_busy(hsspi);
+
+	as->start = ktime_get();
+	ret = spi_async(hsspi->spi, as->msg);
+	if (ret) {
+		dev_err(&hsspi->spi->dev, "spi_async: %d\n", ret);
+		hsspi_clear_spi_slave_busy(hsspi);
+		hsspi_async_failed(hsspi);
+		return hsspi_async_fallback(hsspi);
+	}
+
+	return true;
+}
+
+static bool hsspi_async_tx(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+	struct hsspi_work *hw = as->work;
+	bool headroom;
+	void *data;
+	u16 size;
+
+	as->work = NULL;
+	as->layer = hw->tx.layer;
+	as->length = hsspi_gather(hsspi, hw, &as->batch, false);
+
+	data = hsspi_frame(hsspi, &as->batch, &size, &headroom);
+
+	hsspi->host->flags = STC_HOST_WR;
+	hsspi->host->ul = as->layer->id;
+	hsspi->host->length = as->length;
+
+	if (test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
+		hsspi->host->flags |= STC_HOST_PRD;
+
+	return hsspi_async_xfer(hsspi, HSSPI_ASYNC_TX, data, NULL, size,
+				headroom);
+}
+
+static bool hsspi_async_pre_read(struct hsspi *hsspi)
+{
+	hsspi->host->flags = STC_HOST_PRD;
+	hsspi->host->ul = 0;
+	hsspi->host->length = 0;
+
+	return hsspi_async_xfer(hsspi, HSSPI_ASYNC_PRE_READ, NULL, NULL, 0,
+				false);
+}
+
+static bool hsspi_async_rx(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+	struct hsspi_layer *layer;
+	struct hsspi_block *blk;
+
+	layer = hsspi_get_layer(hsspi, as->rx_ul);
+	if (layer && !layer->atomic_ops)
+		return hsspi_async_fallback(hsspi);
+
+	hsspi->host->flags = STC_HOST_RD;
+	hsspi->host->ul = as->rx_ul;
+	hsspi->host->length = as->rx_length;
+
+	blk = layer ? layer->ops->get(layer, as->rx_length, GFP_ATOMIC) : NULL;
+	as->rx_layer = layer;
+	as->rx_blk = blk;
+
+	return hsspi_async_xfer(hsspi, HSSPI_ASYNC_RX, NULL,
+				blk ? blk->data : NULL, blk ? blk->size : 0,
+				blk && blk->headroom >= HSSPI_HEADROOM);
+}
+
+/**
+ * hsspi_async_ready() - is the QM35 ready for a transaction
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Same as the fast path of hsspi_wait_ss_ready().
+ *
+ * Return: True if ss_ready is up and was toggled since the last
+ * transaction.
+ */
+static bool hsspi_async_ready(struct hsspi *hsspi)
+{
+	if (test_bit(HSSPI_FLAGS_SS_BUSY, hsspi->flags))
+		return false;
+
+	clear_bit(HSSPI_FLAGS_SS_READY, hsspi->flags);
+	return gpiod_get_value(hsspi->gpio_ss_rdy);
+}
+
+/**
+ * hsspi_async_wait_ready() - wait for ss_ready without blocking
+ *
+ * @hsspi: &struct hsspi
+ *
+ * The engine stays owned while waiting: the ss_ready handler resumes
+ * it, or the timer hands it over to the HSSPI thread.
+ *
+ * Return: True if waiting, false if ss_ready is already up again.
+ */
+static bool hsspi_async_wait_ready(struct hsspi *hsspi)
+{
+	hsspi->waiting_ss_rdy = true;
+	hsspi->async.wait_start = ktime_get();
+
+	/* Check if the QM went to sleep and wake it up if it did */
+	if (!gpiod_get_value(hsspi->gpio_exton))
+		hsspi->wakeup(hsspi);
+
+	mod_timer(&hsspi->async.timer,
+		  jiffies + msecs_to_jiffies(SS_READY_TIMEOUT_MS));
+
+	set_bit(HSSPI_FLAGS_ASYNC_WAIT, hsspi->flags);
+	smp_mb__after_atomic();
+
+	/* ss_ready may have risen before HSSPI_FLAGS_ASYNC_WAIT was set */
+	if (!test_bit(HSSPI_FLAGS_SS_BUSY, hsspi->flags) &&
+	    gpiod_get_value(hsspi->gpio_ss_rdy) &&
+	    test_and_clear_bit(HSSPI_FLAGS_ASYNC_WAIT, hsspi->flags))
+		return false;
+
+	return true;
+}
+
+/**
+ * hsspi_async_get_work() - get the next TX work for the engine
+ *
+ * @hsspi: &struct hsspi
+ *
+ * COMPLETION works and expired blocks are handled on the way.
+ *
+ * Return: a TX &struct hsspi_work or NULL.
+ */
+static struct hsspi_work *hsspi_async_get_work(struct hsspi *hsspi)
+{
+	struct hsspi_work *hw;
+
+	while ((hw = get_work(hsspi))) {
+		if (hw->type == HSSPI_WORK_COMPLETION)
+			complete(hw->completion);
+		else if (hw->type != HSSPI_WORK_TX)
+			dev_err(&hsspi->spi->dev,
+				"unknown hsspi_work type: %d\n", hw->type);
+		else if (hw->tx.layer->atomic_ops && hsspi_work_expired(hw))
+			hsspi_work_drop(hsspi, hw);
+		else
+			return hw;
+	}
+	return NULL;
+}
+
+static bool hsspi_async_has_job(struct hsspi *hsspi)
+{
+	return hsspi->async.rx_pending || hsspi->async.work ||
+	       is_txrx_waiting(hsspi);
+}
+
+/**
+ * hsspi_async_run() - start the next transaction of the engine
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Must be called with HSSPI_FLAGS_ASYNC owned. A pending RX is done
+ * first, then the next TX work, then a PRE_READ if SS_IRQ is set.
+ *
+ * Return: True if the engine is still owned, false if there is
+ * nothing left to do.
+ */
+static bool hsspi_async_run(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+
+	while (1) {
+		if (!as->rx_pending && !as->work) {
+			as->work = hsspi_async_get_work(hsspi);
+			if (!as->work &&
+			    !(READ_ONCE(hsspi->state) == HSSPI_RUNNING &&
+			      test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags)))
+				return false;
+		}
+
+		if (!as->rx_pending && as->work &&
+		    !as->work->tx.layer->atomic_ops)
+			return hsspi_async_fallback(hsspi);
+
+		if (hsspi_async_ready(hsspi))
+			break;
+
+		if (hsspi_async_wait_ready(hsspi))
+			return true;
+	}
+
+	if (as->rx_pending)
+		return hsspi_async_rx(hsspi);
+	if (as->work)
+		return hsspi_async_tx(hsspi);
+	return hsspi_async_pre_read(hsspi);
+}
+
+/**
+ * hsspi_async_continue() - run the engine and release it when idle
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Must be called with HSSPI_FLAGS_ASYNC owned.
+ */
+static void hsspi_async_continue(struct hsspi *hsspi)
+{
+	while (!hsspi_async_run(hsspi)) {
+		clear_bit_unlock(HSSPI_FLAGS_ASYNC, hsspi->flags);
+		/* a job queued meanwhile may have seen the engine busy */
+		smp_mb__after_atomic();
+		wake_up_var(&hsspi->async);
+
+		if (!hsspi_async_has_job(hsspi) ||
+		    test_and_set_bit_lock(HSSPI_FLAGS_ASYNC, hsspi->flags))
+			break;
+	}
+}
+
+/**
+ * hsspi_async_kick() - start the engine if it is idle
+ *
+ * @hsspi: &struct hsspi
+ *
+ * Can be called from any context.
+ */
+static void hsspi_async_kick(struct hsspi *hsspi)
+{
+	if (!READ_ONCE(hsspi->async_engine))
+		return;
+
+	if (test_and_set_bit_lock(HSSPI_FLAGS_ASYNC, hsspi->flags))
+		return;
+
+	hsspi_async_continue(hsspi);
+}
+
+static void hsspi_async_tx_done(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+	struct hsspi_work *hw;
+
+	list_for_each_entry(hw, &as->batch, list)
+		hsspi_layer_sent(hsspi, as->layer, hw->tx.blk, 0);
+
+	hsspi_batch_free(hsspi, &as->batch);
+
+	/* Ignore tx check flags */
+	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+
+	if (hsspi->host->flags & STC_HOST_PRD) {
+		as->rx_ul = hsspi->soc->ul;
+		as->rx_length = hsspi->soc->length;
+		as->rx_pending = true;
+	}
+}
+
+static void hsspi_async_pre_read_done(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
+
+	/* Ignore pre-read check flags */
+	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+
+	as->rx_ul = hsspi->soc->ul;
+	as->rx_length = hsspi->soc->length;
+	as->rx_pending = true;
+}
+
+static int hsspi_async_rx_done(struct hsspi *hsspi)
+{
+	struct hsspi_async *as = &hsspi->async;
 
-	if (!(hsspi->soc->flags & STC_SOC_ODW) &&
-	    test_and_clear_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
-		hsspi->odw_cleared(hsspi);
+	if (as->rx_blk)
+		hsspi_layer_received(hsspi, as->rx_layer, as->rx_blk, 0);
 
-	return ret;
+	as->rx_layer = NULL;
+	as->rx_blk = NULL;
+	as->rx_pending = false;
+
+	return hsspi_rx_check(hsspi, as->rx_ul, as->rx_length);
 }
 
 /**
- * hsspi_tx() - send a hsspi block to the QM35 on the HSSPI
+ * hsspi_async_complete() - completion of an asynchronous transaction
  *
- * @hsspi: &struct hsspi
- * @layer: &struct hsspi_layer
- * @blk: &struct hsspi_block
+ * @context: the &struct hsspi
  *
- * It also adds PRD flag if SS_IRQ is set. Therefore it will try a RX
- * transfer accordingly.
+ * Called by the SPI core, possibly in atomic context. Failed
+ * transactions are retried by the HSSPI thread like spi_xfer() does.
  */
-static int hsspi_tx(struct hsspi *hsspi, struct hsspi_layer *layer,
-		    struct hsspi_block *blk)
+static void hsspi_async_complete(void *context)
 {
-	int ret;
+	struct hsspi *hsspi = context;
+	struct hsspi_async *as = &hsspi->async;
+	int ret = as->msg->status;
+	s64 xfer_ns;
+	u8 soc_flags;
 
-	hsspi->host->flags = STC_HOST_WR;
-	hsspi->host->ul = layer->id;
-	hsspi->host->length = blk->length;
+	hsspi_msg_done(hsspi, as->msg, as->start, ret);
+	xfer_ns = hsspi_latency(hsspi, hsspi->host->ul, HSSPI_PHASE_XFER,
+				as->start);
+	soc_flags = hsspi->soc->flags;
 
-	if (test_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags))
-		hsspi->host->flags |= STC_HOST_PRD;
+	trace_hsspi_spi_xfer(&hsspi->spi->dev, hsspi->host, hsspi->soc, ret);
+	hsspi_rec_add(hsspi, ret, as->wait_ns, xfer_ns, 0);
 
-	ret = spi_xfer(hsspi, blk->data, NULL, blk->size);
+	if (ret) {
+		dev_err(&hsspi->spi->dev, "spi_async: %d\n", ret);
+	} else if (!(soc_flags & STC_SOC_RDY) || (soc_flags & 0x0f)) {
+		hsspi->wakeup(hsspi);
+		ret = -EAGAIN;
+	}
 
-	layer->ops->sent(layer, blk, ret);
+	if (ret) {
+		hsspi_async_failed(hsspi);
+		hsspi_async_fallback(hsspi);
+		return;
+	}
 
-	if (ret)
-		return ret;
+	switch (as->phase) {
+	case HSSPI_ASYNC_TX:
+		hsspi_async_tx_done(hsspi);
+		break;
+	case HSSPI_ASYNC_PRE_READ:
+		hsspi_async_pre_read_done(hsspi);
+		break;
+	case HSSPI_ASYNC_RX:
+		ret = hsspi_async_rx_done(hsspi);
+		break;
+	}
 
-	/* Ignore tx check flags */
-	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+	if (hsspi_count_error(hsspi, ret)) {
+		as->reset = true;
+		hsspi_async_fallback(hsspi);
+		return;
+	}
 
-	if (hsspi->host->flags & STC_HOST_PRD)
-		return hsspi_rx(hsspi, hsspi->soc->ul, hsspi->soc->length);
+	hsspi_async_continue(hsspi);
+}
 
-	return ret;
+/**
+ * hsspi_async_timeout() - ss_ready did not come up in time
+ *
+ * @t: &struct hsspi_async.timer
+ */
+static void hsspi_async_timeout(struct timer_list *t)
+{
+	struct hsspi *hsspi = from_timer(hsspi, t, async.timer);
+
+	if (!test_and_clear_bit(HSSPI_FLAGS_ASYNC_WAIT, hsspi->flags))
+		return;
+
+	dev_warn(&hsspi->spi->dev,
+		 "timed out waiting for ss_ready(%d), falling back\n",
+		 test_bit(HSSPI_FLAGS_SS_READY, hsspi->flags));
+	hsspi_async_fallback(hsspi);
 }
 
 /**
- * hsspi_pre_read() - send a PRE_READ with no TX and do RX
+ * hsspi_async_fallback_run() - do the job handed over by the engine
  *
  * @hsspi: &struct hsspi
  *
- * This function is a particular case of hsspi_tx with no layer or
- * blk.
- *
+ * Return: the status of the transaction or 1 if nothing was
+ * transferred.
  */
-static int hsspi_pre_read(struct hsspi *hsspi)
+static int hsspi_async_fallback_run(struct hsspi *hsspi)
 {
+	struct hsspi_async *as = &hsspi->async;
+	struct hsspi_work *hw;
 	int ret;
 
-	hsspi->host->flags = STC_HOST_PRD;
-	hsspi->host->ul = 0;
-	hsspi->host->length = 0;
+	if (as->reset) {
+		as->reset = false;
+		hsspi_error_reset(hsspi);
+		return 1;
+	}
 
-	ret = spi_xfer(hsspi, NULL, NULL, 0);
-	if (ret)
+	if (!list_empty(&as->batch)) {
+		ret = hsspi_tx(hsspi, as->layer, &as->batch, as->length);
+		hsspi_batch_free(hsspi, &as->batch);
 		return ret;
+	}
 
-	/* Ignore pre-read check flags */
-	check_soc_flag(&hsspi->spi->dev, __func__, hsspi->soc->flags, true);
+	if (as->rx_pending) {
+		as->rx_pending = false;
+		return hsspi_rx(hsspi, as->rx_ul, as->rx_length);
+	}
 
-	return hsspi_rx(hsspi, hsspi->soc->ul, hsspi->soc->length);
+	hw = as->work;
+	as->work = NULL;
+	if (!hw) {
+		if (!is_txrx_waiting(hsspi))
+			return 1;
+		hw = get_work(hsspi);
+	}
+
+	return hsspi_process(hsspi, hw);
+}
+
+/**
+ * hsspi_wake() - notify the engine that there is something to do
+ *
+ * @hsspi: &struct hsspi
+ */
+static void hsspi_wake(struct hsspi *hsspi)
+{
+	if (READ_ONCE(hsspi->async_engine))
+		hsspi_async_kick(hsspi);
+	else
+		wake_up_interruptible(&hsspi->wq);
+}
+
+static bool hsspi_thread_waiting(struct hsspi *hsspi)
+{
+	if (test_bit(HSSPI_FLAGS_FALLBACK, hsspi->flags))
+		return true;
+
+	return !READ_ONCE(hsspi->async_engine) && is_txrx_waiting(hsspi);
 }
 
 /**
  * hsspi_thread_fn() - the thread that manage all SPI transfers
  * @data: the &struct hsspi
  *
+ * With the asynchronous engine, it only does the jobs handed over by
+ * hsspi_async_fallback().
  */
 static int hsspi_thread_fn(void *data)
 {
 	struct hsspi *hsspi = data;
-	static int successive_errors;
 
-	successive_errors = 0;
+	hsspi->successive_errors = 0;
 	while (1) {
-		struct hsspi_work *hw;
+		bool fallback;
 		int ret;
 
 		ret = wait_event_interruptible(hsspi->wq,
-					       is_txrx_waiting(hsspi) ||
+					       hsspi_thread_waiting(hsspi) ||
 						       kthread_should_stop());
 		if (ret)
 			return ret;
@@ -434,75 +2139,175 @@ static int hsspi_thread_fn(void *data)
 		if (kthread_should_stop())
 			break;
 
-		hw = get_work(hsspi);
-		if (hw) {
-			if (hw->type == HSSPI_WORK_COMPLETION) {
-				complete(hw->completion);
-				/* on the stack no need to free */
-				continue;
-			} else if (hw->type == HSSPI_WORK_TX) {
-				ret = hsspi_tx(hsspi, hw->tx.layer, hw->tx.blk);
-				kfree(hw);
-			} else {
-				dev_err(&hsspi->spi->dev,
-					"unknown hsspi_work type: %d\n",
-					hw->type);
-				continue;
-			}
-		} else
-			/* If there is no work, we are here because
-			 * SS_IRQ is set.
-			 */
-			ret = hsspi_pre_read(hsspi);
+		fallback = test_bit(HSSPI_FLAGS_FALLBACK, hsspi->flags);
+		if (fallback)
+			ret = hsspi_async_fallback_run(hsspi);
+		else
+			ret = hsspi_process(hsspi, get_work(hsspi));
 
-		if (ret) {
-			successive_errors++;
-
-			if (successive_errors > MAX_SUCCESSIVE_ERRORS) {
-				dev_err(&hsspi->spi->dev,
-					"Max successive errors %d reached, likely entered ROM code...\n",
-					successive_errors);
-
-				/* When the device reboots, the ROM code might raise
-				 * ss_ready; if a SPI transfer is requested, the AP
-				 * will initiate the SPI xfer and the ROM code will
-				 * enter its command mode infinite loop...
-				 * No choice but rebooting the device.
-				 */
-				hsspi->reset_qm35(hsspi);
-				successive_errors = 0;
-			}
-		} else {
-			successive_errors = 0;
+		/* When the device reboots, the ROM code might raise
+		 * ss_ready; if a SPI transfer is requested, the AP
+		 * will initiate the SPI xfer and the ROM code will
+		 * enter its command mode infinite loop...
+		 * No choice but rebooting the device.
+		 */
+		if (ret <= 0 && hsspi_count_error(hsspi, ret))
+			hsspi_error_reset(hsspi);
+
+		if (fallback) {
+			clear_bit(HSSPI_FLAGS_FALLBACK, hsspi->flags);
+			hsspi_async_continue(hsspi);
 		}
 	}
 	return 0;
 }
 
+/**
+ * hsspi_init_msgs() - set up the STC header message
+ *
+ * @hsspi: &struct hsspi
+ *
+ * On kernels providing spi_optimize_message(), the header only message
+ * is validated and prepared by the controller now instead of at each
+ * transaction. Failing to do so is not fatal, the SPI core then does
+ * it for each transaction as before.
+ */
+static void hsspi_init_msgs(struct hsspi *hsspi)
+{
+	hsspi->hdr_xfer.tx_buf = hsspi->host;
+	hsspi->hdr_xfer.rx_buf = hsspi->soc;
+	hsspi->hdr_xfer.len = sizeof(*(hsspi->host));
+	spi_message_init_with_transfers(&hsspi->hdr_msg, &hsspi->hdr_xfer, 1);
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0))
+	if (!spi_optimize_message(hsspi->spi, &hsspi->hdr_msg))
+		hsspi->hdr_msg_optimized = true;
+	else
+		dev_warn(&hsspi->spi->dev,
+			 "cannot optimize the STC header message\n");
+#endif
+}
+
+static void hsspi_deinit_msgs(struct hsspi *hsspi)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0))
+	if (hsspi->hdr_msg_optimized)
+		spi_unoptimize_message(&hsspi->hdr_msg);
+#endif
+	hsspi->hdr_msg_optimized = false;
+}
+
+/**
+ * hsspi_check_dma() - tell whether the SPI core bounces the buffers
+ *
+ * @hsspi: &struct hsspi
+ *
+ * The buffers are plain kmalloc() memory anywhere in RAM: the SPI core
+ * maps them with streaming DMA for the device below and swiotlb copies
+ * the ones out of its DMA mask. Nothing fails when memory is fragmented,
+ * but each such transfer pays a copy, so say it once.
+ */
+static void hsspi_check_dma(struct hsspi *hsspi)
+{
+	struct spi_controller *ctlr = hsspi->spi->controller;
+	struct device *dev;
+	u64 required;
+
+	/* same device as the SPI core uses to map the transfers */
+	if (ctlr->dma_tx)
+		dev = ctlr->dma_tx->device->dev;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0))
+	else if (ctlr->dma_map_dev)
+		dev = ctlr->dma_map_dev;
+#endif
+	else
+		dev = ctlr->dev.parent;
+
+	/* PIO only controller */
+	if (!ctlr->can_dma || !dev || !dev->dma_mask)
+		return;
+
+	required = dma_get_required_mask(dev);
+	if (required > dma_get_mask(dev))
+		dev_info(&hsspi->spi->dev,
+			 "%s DMA mask %#llx below RAM %#llx, some transfers are bounced\n",
+			 dev_name(dev), dma_get_mask(dev), required);
+}
+
 int hsspi_init(struct hsspi *hsspi, struct spi_device *spi)
 {
+	int ret;
+	int i;
+
 	memset(hsspi, 0, sizeof(*hsspi));
 
 	spin_lock_init(&hsspi->lock);
-	INIT_LIST_HEAD(&hsspi->work_list);
+
+	for (i = 0; i < ARRAY_SIZE(hsspi->queues); i++) {
+		init_llist_head(&hsspi->queues[i].queue);
+		INIT_LIST_HEAD(&hsspi->queues[i].pending);
+		hsspi->queues[i].prio = hsspi_default_prio[i];
+	}
+	init_llist_head(&hsspi->ctrl_queue.queue);
+	INIT_LIST_HEAD(&hsspi->ctrl_queue.pending);
+	hsspi->starvation_limit = HSSPI_STARVATION_LIMIT;
+	hsspi->coalesce_delay_us = HSSPI_COALESCE_DELAY_US;
+	hsspi->ss_ready_spin_us = HSSPI_SS_READY_SPIN_US;
+	cpumask_copy(&hsspi->sched_cpus, cpu_possible_mask);
+
+	INIT_LIST_HEAD(&hsspi->async.batch);
+	timer_setup(&hsspi->async.timer, hsspi_async_timeout, 0);
 
 	hsspi->state = HSSPI_STOPPED;
 	hsspi->spi = spi;
 
+	/* CS must stay active from the header message to the data one,
+	 * which the core message loop does when the last transfer has
+	 * cs_change set
+	 */
+	hsspi->duplex_ctlr =
+		!(spi->controller->flags & SPI_CONTROLLER_HALF_DUPLEX) &&
+		!(spi->mode & SPI_3WIRE) && spi->controller->transfer_one;
+
 	init_waitqueue_head(&hsspi->wq);
 	init_waitqueue_head(&hsspi->wq_ready);
 
-	hsspi->host = kmalloc(sizeof(*(hsspi->host)), GFP_KERNEL | GFP_DMA);
-	hsspi->soc = kmalloc(sizeof(*(hsspi->soc)), GFP_KERNEL | GFP_DMA);
+	/* no GFP_DMA: the SPI core maps the buffers for the controller
+	 * and bounces them if its DMA mask requires it
+	 */
+	hsspi->host = kmalloc(sizeof(*(hsspi->host)), GFP_KERNEL);
+	hsspi->soc = kmalloc(sizeof(*(hsspi->soc)), GFP_KERNEL);
+	hsspi->tx_frame = kmalloc(MAX_STC_FRAME_LEN, GFP_KERNEL);
+	hsspi->rx_frame = kmalloc(MAX_STC_FRAME_LEN, GFP_KERNEL);
+	if (!hsspi->host || !hsspi->soc || !hsspi->tx_frame ||
+	    !hsspi->rx_frame) {
+		ret = -ENOMEM;
+		goto free_buffers;
+	}
+
+	hsspi_init_msgs(hsspi);
+	hsspi_check_dma(hsspi);
 
 	hsspi->thread = kthread_create(hsspi_thread_fn, hsspi, "hsspi");
-	if (IS_ERR(hsspi->thread))
-		return PTR_ERR(hsspi->thread);
+	if (IS_ERR(hsspi->thread)) {
+		ret = PTR_ERR(hsspi->thread);
+		goto deinit_msgs;
+	}
 
 	wake_up_process(hsspi->thread);
 
 	dev_info(&hsspi->spi->dev, "HSSPI initialized\n");
 	return 0;
+
+deinit_msgs:
+	hsspi_deinit_msgs(hsspi);
+free_buffers:
+	kfree(hsspi->rec.entries);
+	kfree(hsspi->host);
+	kfree(hsspi->soc);
+	kfree(hsspi->tx_frame);
+	kfree(hsspi->rx_frame);
+	return ret;
 }
 
 void hsspi_set_gpios(struct hsspi *hsspi, struct gpio_desc *gpio_ss_rdy,
@@ -514,12 +2319,13 @@ void hsspi_set_gpios(struct hsspi *hsspi, struct gpio_desc *gpio_ss_rdy,
 
 int hsspi_deinit(struct hsspi *hsspi)
 {
+	unsigned long flags;
 	int i;
 
-	spin_lock(&hsspi->lock);
+	spin_lock_irqsave(&hsspi->lock, flags);
 
 	if (hsspi->state == HSSPI_RUNNING) {
-		spin_unlock(&hsspi->lock);
+		spin_unlock_irqrestore(&hsspi->lock, flags);
 		return -EBUSY;
 	}
 
@@ -530,16 +2336,27 @@ int hsspi_deinit(struct hsspi *hsspi)
 		dev_err(&hsspi->spi->dev,
 			"HSSPI upper layer '%s' not unregistered\n",
 			hsspi->layers[i]->name);
-		spin_unlock(&hsspi->lock);
+		spin_unlock_irqrestore(&hsspi->lock, flags);
 		return -EBUSY;
 	}
 
-	spin_unlock(&hsspi->lock);
+	spin_unlock_irqrestore(&hsspi->lock, flags);
+
+	/* let the asynchronous engine finish its last job */
+	WRITE_ONCE(hsspi->async_engine, false);
+	wait_var_event(&hsspi->async,
+		       !test_bit(HSSPI_FLAGS_ASYNC, hsspi->flags));
+	del_timer_sync(&hsspi->async.timer);
 
 	kthread_stop(hsspi->thread);
 
+	hsspi_deinit_msgs(hsspi);
+
+	kfree(hsspi->rec.entries);
 	kfree(hsspi->host);
 	kfree(hsspi->soc);
+	kfree(hsspi->tx_frame);
+	kfree(hsspi->rx_frame);
 
 	dev_info(&hsspi->spi->dev, "HSSPI uninitialized\n");
 	return 0;
@@ -547,19 +2364,20 @@ int hsspi_deinit(struct hsspi *hsspi)
 
 int hsspi_register(struct hsspi *hsspi, struct hsspi_layer *layer)
 {
+	unsigned long flags;
 	int ret = 0;
 
 	if (!layer_id_is_valid(hsspi, layer->id))
 		return -EINVAL;
 
-	spin_lock(&hsspi->lock);
+	spin_lock_irqsave(&hsspi->lock, flags);
 
 	if (hsspi->layers[layer->id])
 		ret = -EBUSY;
 	else
-		hsspi->layers[layer->id] = layer;
+		WRITE_ONCE(hsspi->layers[layer->id], layer);
 
-	spin_unlock(&hsspi->lock);
+	spin_unlock_irqrestore(&hsspi->lock, flags);
 
 	if (ret) {
 		dev_err(&hsspi->spi->dev, "%s: '%s' ret: %d\n", __func__,
@@ -579,21 +2397,20 @@ int hsspi_unregister(struct hsspi *hsspi, struct hsspi_layer *layer)
 		.type = HSSPI_WORK_COMPLETION,
 		.completion = &complete,
 	};
+	unsigned long flags;
 	int ret = 0;
 
 	if (!layer_id_is_valid(hsspi, layer->id))
 		return -EINVAL;
 
-	spin_lock(&hsspi->lock);
+	spin_lock_irqsave(&hsspi->lock, flags);
 
-	if (hsspi->layers[layer->id] == layer) {
-		hsspi->layers[layer->id] = NULL;
-
-		list_add_tail(&complete_work.list, &hsspi->work_list);
-	} else
+	if (hsspi->layers[layer->id] == layer)
+		WRITE_ONCE(hsspi->layers[layer->id], NULL);
+	else
 		ret = -EINVAL;
 
-	spin_unlock(&hsspi->lock);
+	spin_unlock_irqrestore(&hsspi->lock, flags);
 
 	if (ret) {
 		dev_err(&hsspi->spi->dev, "%s: '%s' ret: %d\n", __func__,
@@ -601,10 +2418,16 @@ int hsspi_unregister(struct hsspi *hsspi, struct hsspi_layer *layer)
 		return ret;
 	}
 
-	wake_up_interruptible(&hsspi->wq);
+	/* wait for the hsspi_send() that still see the layer registered
+	 * so that their works are queued before the completion one
+	 */
+	synchronize_rcu();
+
+	hsspi_queue_work(&hsspi->queues[layer->id], &complete_work);
+	hsspi_wake(hsspi);
 
 	/* when completed there is no more reference to layer in the
-	 * work_list or in the hsspi_thread_fn
+	 * work queue or in the hsspi_thread_fn
 	 */
 	wait_for_completion(&complete);
 
@@ -613,6 +2436,107 @@ int hsspi_unregister(struct hsspi *hsspi, struct hsspi_layer *layer)
 	return 0;
 }
 
+int hsspi_set_speed(struct hsspi *hsspi, u8 ul, enum hsspi_clk_phase phase,
+		    u32 speed_hz)
+{
+	if (ul >= UL_MAX_IDX || phase >= HSSPI_CLK_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(hsspi->speed_hz[ul][phase], speed_hz);
+	return 0;
+}
+
+int hsspi_rec_init(struct hsspi *hsspi, unsigned int len)
+{
+	struct hsspi_rec_entry *entries = NULL;
+
+	if (len) {
+		len = roundup_pow_of_two(len);
+		entries = kcalloc(len, sizeof(*entries), GFP_KERNEL);
+		if (!entries)
+			return -ENOMEM;
+	}
+
+	kfree(hsspi->rec.entries);
+	hsspi->rec.entries = entries;
+	hsspi->rec.mask = len ? len - 1 : 0;
+	atomic_set(&hsspi->rec.seq, 0);
+	return 0;
+}
+
+static int hsspi_set_prio(struct hsspi *hsspi, int prio)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0))
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = prio ? SCHED_FIFO : SCHED_NORMAL,
+		.sched_priority = prio,
+	};
+
+	/* sched_setscheduler_nocheck() is not exported anymore */
+	return sched_setattr_nocheck(hsspi->thread, &attr);
+#else
+	struct sched_param param = { .sched_priority = prio };
+
+	return sched_setscheduler_nocheck(hsspi->thread,
+					  prio ? SCHED_FIFO : SCHED_NORMAL,
+					  &param);
+#endif
+}
+
+int hsspi_set_sched(struct hsspi *hsspi, int prio, const struct cpumask *cpus)
+{
+	int ret;
+
+	if (prio < 0 || prio >= MAX_RT_PRIO)
+		return -EINVAL;
+
+	if (!cpus)
+		cpus = cpu_possible_mask;
+
+	ret = hsspi_set_prio(hsspi, prio);
+	if (ret)
+		return ret;
+
+	ret = set_cpus_allowed_ptr(hsspi->thread, cpus);
+	if (ret) {
+		/* all or nothing */
+		hsspi_set_prio(hsspi, hsspi->sched_prio);
+		return ret;
+	}
+
+	cpumask_copy(&hsspi->sched_cpus, cpus);
+	hsspi->sched_prio = prio;
+	return 0;
+}
+
+int hsspi_set_async(struct hsspi *hsspi, bool enable)
+{
+#ifdef HSSPI_MANUAL_CS_SETUP
+	if (enable)
+		return -EOPNOTSUPP;
+#endif
+	if (enable && (gpiod_cansleep(hsspi->gpio_ss_rdy) ||
+		       gpiod_cansleep(hsspi->gpio_exton)))
+		return -EOPNOTSUPP;
+
+	WRITE_ONCE(hsspi->async_engine, enable);
+	wake_up_interruptible(&hsspi->wq);
+
+	dev_info(&hsspi->spi->dev, "HSSPI %s engine\n",
+		 enable ? "asynchronous" : "thread");
+	return 0;
+}
+
+int hsspi_set_layer_prio(struct hsspi *hsspi, u8 ul, u8 prio)
+{
+	if (!layer_id_is_valid(hsspi, ul))
+		return -EINVAL;
+
+	WRITE_ONCE(hsspi->queues[ul].prio, prio);
+	return 0;
+}
+
 void hsspi_clear_spi_slave_busy(struct hsspi *hsspi)
 {
 	clear_bit(HSSPI_FLAGS_SS_BUSY, hsspi->flags);
@@ -628,6 +2552,10 @@ void hsspi_set_spi_slave_ready(struct hsspi *hsspi)
 	set_bit(HSSPI_FLAGS_SS_READY, hsspi->flags);
 
 	wake_up_interruptible(&hsspi->wq_ready);
+
+	/* resume the asynchronous engine waiting for ss_ready */
+	if (test_and_clear_bit(HSSPI_FLAGS_ASYNC_WAIT, hsspi->flags))
+		hsspi_async_continue(hsspi);
 }
 
 void hsspi_clear_spi_slave_ready(struct hsspi *hsspi)
@@ -635,22 +2563,131 @@ void hsspi_clear_spi_slave_ready(struct hsspi *hsspi)
 	clear_bit(HSSPI_FLAGS_SS_READY, hsspi->flags);
 }
 
-void hsspi_set_output_data_waiting(struct hsspi *hsspi)
+/**
+ * hsspi_kick_rx() - service a deferred ss_irq unless throttled
+ *
+ * @hsspi: &struct hsspi
+ */
+static void hsspi_kick_rx(struct hsspi *hsspi)
 {
+	if (test_bit(HSSPI_FLAGS_RX_THROTTLED, hsspi->flags) ||
+	    !test_and_clear_bit(HSSPI_FLAGS_SS_IRQ_DEFERRED, hsspi->flags))
+		return;
+
 	set_bit(HSSPI_FLAGS_SS_IRQ, hsspi->flags);
 
-	wake_up_interruptible(&hsspi->wq);
+	hsspi_wake(hsspi);
+}
+
+void hsspi_set_output_data_waiting(struct hsspi *hsspi)
+{
+	set_bit(HSSPI_FLAGS_SS_IRQ_DEFERRED, hsspi->flags);
+	/* pairs with hsspi_throttle_rx() */
+	smp_mb__after_atomic();
+	hsspi_kick_rx(hsspi);
 }
 
-int hsspi_init_block(struct hsspi_block *blk, u16 length)
+void hsspi_throttle_rx(struct hsspi *hsspi, bool throttle)
 {
-	void *data;
+	if (throttle) {
+		set_bit(HSSPI_FLAGS_RX_THROTTLED, hsspi->flags);
+		return;
+	}
+
+	clear_bit(HSSPI_FLAGS_RX_THROTTLED, hsspi->flags);
+	/* pairs with hsspi_set_output_data_waiting() */
+	smp_mb__after_atomic();
+	hsspi_kick_rx(hsspi);
+}
+
+/* size classes of the block pools, HSSPI_HEADROOM excluded */
+static const u16 hsspi_pool_size[] = { 64, 256, MAX_STC_FRAME_LEN };
+/* blocks reserved per class, enough for the queues of all the layers */
+static const u8 hsspi_pool_reserve[] = { 16, 8, 4 };
+
+static struct kmem_cache *hsspi_caches[ARRAY_SIZE(hsspi_pool_size)];
+static mempool_t *hsspi_pools[ARRAY_SIZE(hsspi_pool_size)];
+
+int hsspi_pools_init(void)
+{
+	static const char *const names[] = {
+		"hsspi_block_64", "hsspi_block_256", "hsspi_block_frame"
+	};
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(names) != ARRAY_SIZE(hsspi_pool_size));
+
+	for (i = 0; i < ARRAY_SIZE(hsspi_pool_size); i++) {
+		/* cache line aligned as kmalloc() for streaming DMA */
+		hsspi_caches[i] = kmem_cache_create(
+			names[i], HSSPI_HEADROOM + hsspi_pool_size[i],
+			dma_get_cache_alignment(), 0, NULL);
+		if (!hsspi_caches[i])
+			goto error;
+
+		hsspi_pools[i] = mempool_create_slab_pool(
+			hsspi_pool_reserve[i], hsspi_caches[i]);
+		if (!hsspi_pools[i])
+			goto error;
+	}
+	return 0;
+
+error:
+	hsspi_pools_exit();
+	return -ENOMEM;
+}
+
+void hsspi_pools_exit(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hsspi_pool_size); i++) {
+		mempool_destroy(hsspi_pools[i]);
+		kmem_cache_destroy(hsspi_caches[i]);
+		hsspi_pools[i] = NULL;
+		hsspi_caches[i] = NULL;
+	}
+}
+
+/**
+ * hsspi_pool() - size class of a block
+ *
+ * @length: length of the block
+ *
+ * Return: the index + 1 of the smallest class fitting @length or 0 if
+ * none does.
+ */
+static u8 hsspi_pool(u16 length)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hsspi_pool_size); i++)
+		if (length <= hsspi_pool_size[i])
+			return i + 1;
+	return 0;
+}
 
-	data = krealloc(blk->data, length, GFP_KERNEL | GFP_DMA);
-	if (!data)
+int hsspi_init_block(struct hsspi_block *blk, u16 length, gfp_t gfp)
+{
+	void *buf = blk->data ? blk->data - blk->headroom : NULL;
+	u8 pool = hsspi_pool(length);
+
+	/* a pool buffer is kept if the class is the same */
+	if (buf && (pool || blk->pool) && blk->pool != pool) {
+		hsspi_deinit_block(blk);
+		buf = NULL;
+	}
+
+	if (!pool)
+		buf = krealloc(buf, HSSPI_HEADROOM + length, gfp);
+	else if (!buf)
+		buf = mempool_alloc(hsspi_pools[pool - 1], gfp);
+	if (!buf)
 		return -ENOMEM;
 
-	blk->data = data;
+	blk->data = buf + HSSPI_HEADROOM;
+	blk->headroom = HSSPI_HEADROOM;
+	blk->pool = pool;
 	blk->length = length;
 	blk->size = length;
 
@@ -659,64 +2696,105 @@ int hsspi_init_block(struct hsspi_block *blk, u16 length)
 
 void hsspi_deinit_block(struct hsspi_block *blk)
 {
-	kfree(blk->data);
+	void *buf = blk->data ? blk->data - blk->headroom : NULL;
+
+	if (buf && blk->pool)
+		mempool_free(buf, hsspi_pools[blk->pool - 1]);
+	else
+		kfree(buf);
 	blk->data = NULL;
+	blk->headroom = 0;
+	blk->pool = 0;
 }
 
-int hsspi_send(struct hsspi *hsspi, struct hsspi_layer *layer,
-	       struct hsspi_block *blk)
+int hsspi_send_batch(struct hsspi *hsspi, struct hsspi_layer *layer,
+		     struct hsspi_block **blks, int n)
 {
-	struct hsspi_work *tx_work;
+	struct hsspi_work *first = NULL, *last = NULL, *tx_work;
+	ktime_t start = ktime_get();
 	int ret = 0;
+	int i;
 
-	if (!layer || !blk)
+	if (!layer || !blks || n <= 0)
 		return -EINVAL;
 
 	if (!layer_id_is_valid(hsspi, layer->id))
 		return -EINVAL;
 
-	tx_work = kzalloc(sizeof(*tx_work), GFP_KERNEL);
-	if (!tx_work)
-		return -ENOMEM;
-
-	tx_work->type = HSSPI_WORK_TX;
-	tx_work->tx.blk = blk;
-	tx_work->tx.layer = layer;
+	/* chained from the last block to the first one, as llist */
+	for (i = 0; i < n; i++) {
+		tx_work = hsspi_work_get(hsspi, blks[i]);
+		tx_work->type = HSSPI_WORK_TX;
+		tx_work->tx.blk = blks[i];
+		tx_work->tx.layer = layer;
+		tx_work->node.next = first ? &first->node : NULL;
+		first = tx_work;
+		if (!last)
+			last = tx_work;
+	}
 
-	spin_lock(&hsspi->lock);
+	/* hsspi_stop() and hsspi_unregister() wait for a grace period
+	 * before queuing their COMPLETION work, the check and the queuing
+	 * must then be done in the same RCU read-side critical section.
+	 */
+	rcu_read_lock();
 
-	if (hsspi->state == HSSPI_RUNNING) {
-		if (hsspi->layers[layer->id] == layer)
-			list_add_tail(&tx_work->list, &hsspi->work_list);
+	if (READ_ONCE(hsspi->state) == HSSPI_RUNNING) {
+		if (READ_ONCE(hsspi->layers[layer->id]) == layer)
+			hsspi_queue_works(&hsspi->queues[layer->id], first,
+					  last, n);
 		else
 			ret = -EINVAL;
 	} else
 		ret = -EAGAIN;
 
-	spin_unlock(&hsspi->lock);
+	rcu_read_unlock();
 
 	if (ret) {
-		kfree(tx_work);
-		dev_err(&hsspi->spi->dev, "%s: %d\n", __func__, ret);
-		return ret;
+		dev_err_ratelimited(&hsspi->spi->dev, "%s: %d\n", __func__,
+				    ret);
+		goto free;
 	}
 
-	wake_up_interruptible(&hsspi->wq);
+	hsspi_wake(hsspi);
 
-	dev_dbg(&hsspi->spi->dev, "send %d bytes on HSSPI '%s' layer\n",
-		blk->length, layer->name);
+	hsspi_latency(hsspi, layer->id, HSSPI_PHASE_ENQUEUE, start);
+
+	dev_dbg(&hsspi->spi->dev, "send %d blocks on HSSPI '%s' layer\n", n,
+		layer->name);
 	return 0;
+
+free:
+	for (i = 0; i < n; i++)
+		hsspi_work_put(hsspi);
+	return ret;
+}
+
+int hsspi_send(struct hsspi *hsspi, struct hsspi_layer *layer,
+	       struct hsspi_block *blk)
+{
+	if (!blk)
+		return -EINVAL;
+
+	return hsspi_send_batch(hsspi, layer, &blk, 1);
 }
 
 void hsspi_start(struct hsspi *hsspi)
 {
-	spin_lock(&hsspi->lock);
+	unsigned long flags;
 
-	hsspi->state = HSSPI_RUNNING;
+	/* the firmware may have changed */
+	clear_bit(HSSPI_FLAGS_DUPLEX_FW, hsspi->flags);
+	clear_bit(HSSPI_FLAGS_DUPLEX_NO_FW, hsspi->flags);
+	hsspi->duplex_misses = 0;
 
-	spin_unlock(&hsspi->lock);
+	spin_lock_irqsave(&hsspi->lock, flags);
 
-	wake_up_interruptible(&hsspi->wq);
+	WRITE_ONCE(hsspi->state, HSSPI_RUNNING);
+
+	spin_unlock_irqrestore(&hsspi->lock, flags);
+
+	hsspi_wake(hsspi);
 
 	dev_dbg(&hsspi->spi->dev, "HSSPI started\n");
 }
@@ -728,16 +2806,19 @@ void hsspi_stop(struct hsspi *hsspi)
 		.type = HSSPI_WORK_COMPLETION,
 		.completion = &complete,
 	};
+	unsigned long flags;
 
-	spin_lock(&hsspi->lock);
+	spin_lock_irqsave(&hsspi->lock, flags);
 
-	hsspi->state = HSSPI_STOPPED;
+	WRITE_ONCE(hsspi->state, HSSPI_STOPPED);
 
-	list_add_tail(&complete_work.list, &hsspi->work_list);
+	spin_unlock_irqrestore(&hsspi->lock, flags);
 
-	spin_unlock(&hsspi->lock);
+	/* see hsspi_unregister() */
+	synchronize_rcu();
 
-	wake_up_interruptible(&hsspi->wq);
+	hsspi_queue_work(&hsspi->ctrl_queue, &complete_work);
+	hsspi_wake(hsspi);
 
 	wait_for_completion(&complete);
 
@@ -29,11 +29,16 @@
 #ifndef __HSSPI_H__
 #define __HSSPI_H__
 
+#include <linux/atomic.h>
+#include <linux/cpumask.h>
 #include <linux/gpio.h>
+#include <linux/ktime.h>
 #include <linux/kthread.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/spinlock.h>
 #include <linux/spi/spi.h>
+#include <linux/timer.h>
 #include <linux/wait.h>
 
 enum { UL_RESERVED,
@@ -55,11 +60,214 @@ enum hsspi_work_type {
 	HSSPI_WORK_COMPLETION,
 };
 
+struct hsspi_block;
+struct hsspi_layer;
+
+/**
+ * struct hsspi_work - HSSPI work item
+ * @node: link with &struct hsspi_queue.queue
+ * @list: link with &struct hsspi_queue.pending
+ * @type: &enum hsspi_work_type
+ * @queued_at: time at which the work was queued
+ * @tx: TX work, block to send and its upper layer
+ * @completion: COMPLETION work, completed when the work is handled
+ *
+ * TX works are embedded in the &struct hsspi_block they send, COMPLETION
+ * works are always allocated on the stack.
+ */
+struct hsspi_work {
+	struct llist_node node;
+	struct list_head list;
+	enum hsspi_work_type type;
+	ktime_t queued_at;
+	union {
+		struct {
+			struct hsspi_block *blk;
+			struct hsspi_layer *layer;
+		} tx;
+		struct completion *completion;
+	};
+};
+
+/**
+ * struct hsspi_work_stats - Accounting of the TX works
+ * @in_use: number of blocks currently queued or being sent
+ * @high_water: maximum value reached by @in_use
+ */
+struct hsspi_work_stats {
+	atomic_t in_use;
+	atomic_t high_water;
+};
+
+/**
+ * struct hsspi_queue - HSSPI work queue
+ * @queue: lockless multi-producers/single-consumer queue
+ * @pending: works moved from @queue, sorted by deadline then in FIFO
+ * order, only accessed by the HSSPI thread
+ * @prio: priority of the queue, 0 is the highest
+ * @skipped: number of times the queue was passed over while not empty
+ * @depth: number of works in the queue
+ * @max_depth: maximum value reached by @depth
+ * @dequeued: number of works taken out of the queue
+ * @wait_ns: cumulative time spent in the queue by the dequeued works
+ * @max_wait_ns: maximum time spent in the queue by a work
+ * @expired: number of blocks dropped because they missed their deadline
+ * @coalesced: number of blocks sent in the frame of a previous block
+ */
+struct hsspi_queue {
+	struct llist_head queue;
+	struct list_head pending;
+	u8 prio;
+	unsigned int skipped;
+	atomic_t depth;
+	atomic_t max_depth;
+	u64 dequeued;
+	u64 wait_ns;
+	u64 max_wait_ns;
+	u64 expired;
+	u64 coalesced;
+};
+
+#define HSSPI_STARVATION_LIMIT 8
+#define HSSPI_COALESCE_DELAY_US 0
+
+#define HSSPI_SS_READY_SPIN_US 0
+
+/**
+ * struct hsspi_hist - log2 histogram of durations
+ * @count: bucket 0 counts durations under 1us, bucket i > 0 the ones in
+ * [2^(i-1), 2^i) us, the last bucket also counts everything above
+ *
+ * Updated concurrently by the producers, the HSSPI thread and the
+ * asynchronous engine, hence the atomic counters.
+ */
+struct hsspi_hist {
+	atomic64_t count[16];
+};
+
+/**
+ * enum hsspi_phase - Phases of the life of a HSSPI transaction
+ * @HSSPI_PHASE_ENQUEUE: hsspi_send() call
+ * @HSSPI_PHASE_QUEUED: time spent in the TX queue
+ * @HSSPI_PHASE_SS_READY: wait for ss_ready before a transaction
+ * @HSSPI_PHASE_XFER: the SPI transaction itself
+ * @HSSPI_PHASE_CALLBACK: &struct hsspi_layer_ops sent or received
+ * callback
+ */
+enum hsspi_phase {
+	HSSPI_PHASE_ENQUEUE = 0,
+	HSSPI_PHASE_QUEUED,
+	HSSPI_PHASE_SS_READY,
+	HSSPI_PHASE_XFER,
+	HSSPI_PHASE_CALLBACK,
+	HSSPI_PHASE_MAX,
+};
+
+#define HSSPI_REC_LEN 64
+
+/**
+ * struct hsspi_rec_entry - Flight recorder entry
+ * @ts_ns: ktime_get_ns() at the end of the STC transaction
+ * @seq: sequence number of the entry, 0 while it is written
+ * @ret: status of the transaction
+ * @ss_ready_ns: time spent waiting for ss_ready before it
+ * @xfer_ns: duration of the SPI transfer, 0 if it was not attempted
+ * @host: host STC header
+ * @soc: SoC STC header
+ * @retry: attempt number, 0 for the first one
+ * @reserved: padding, always 0
+ *
+ * This is also the record format of hsspi/flight_recorder.bin.
+ */
+struct hsspi_rec_entry {
+	u64 ts_ns;
+	u32 seq;
+	s32 ret;
+	u32 ss_ready_ns;
+	u32 xfer_ns;
+	struct stc_header host;
+	struct stc_header soc;
+	u8 retry;
+	u8 reserved[7];
+};
+
+#define HSSPI_REC_FMT                                                    \
+	"%llu #%u try:%u host flags:0x%02x ul:%u len:%u | soc flags:0x%02x " \
+	"ul:%u len:%u rc=%d ss_ready:%uus xfer:%uus"
+#define HSSPI_REC_ARG(e)                                                  \
+	(e)->ts_ns, (e)->seq, (e)->retry, (e)->host.flags, (e)->host.ul,      \
+		(e)->host.length, (e)->soc.flags, (e)->soc.ul, (e)->soc.length, \
+		(e)->ret, (e)->ss_ready_ns / 1000, (e)->xfer_ns / 1000
+
+/**
+ * struct hsspi_rec - Flight recorder of the last STC transactions
+ * @entries: ring of entries, its length is a power of two
+ * @mask: length of @entries minus one
+ * @seq: sequence number of the last entry
+ *
+ * Writers claim an entry with @seq and don't take any lock. Readers
+ * check the sequence number of an entry before and after copying it.
+ */
+struct hsspi_rec {
+	struct hsspi_rec_entry *entries;
+	u32 mask;
+	atomic_t seq;
+};
+
+/**
+ * enum hsspi_clk_phase - Parts of a STC transaction with their own clock
+ * @HSSPI_CLK_HEADER: STC headers, when sent as a separate transfer
+ * @HSSPI_CLK_TX: TX payload
+ * @HSSPI_CLK_RX: RX payload
+ */
+enum hsspi_clk_phase {
+	HSSPI_CLK_HEADER = 0,
+	HSSPI_CLK_TX,
+	HSSPI_CLK_RX,
+	HSSPI_CLK_MAX,
+};
+
+/**
+ * struct hsspi_throughput - Payload throughput of an upper layer
+ * @bytes: number of bytes transferred, headers included
+ * @ns: time spent in the transfers
+ */
+struct hsspi_throughput {
+	u64 bytes;
+	u64 ns;
+};
+
+/**
+ * struct hsspi_ss_ready_stats - ss_ready wait statistics
+ * @spun: number of waits ended while spinning
+ * @slept: number of waits ended sleeping
+ * @spin_ns: total time spent spinning, successfully or not
+ * @spin_hist: ss_ready latency of the @spun waits
+ * @sleep_hist: ss_ready latency of the @slept waits
+ */
+struct hsspi_ss_ready_stats {
+	u64 spun;
+	u64 slept;
+	u64 spin_ns;
+	struct hsspi_hist spin_hist;
+	struct hsspi_hist sleep_hist;
+};
+
+/* Room reserved before the data of a block for the STC header */
+#define HSSPI_HEADROOM sizeof(struct stc_header)
+
 /**
  * struct hsspi_block - Memory block used by the HSSPI.
  * @data: pointer to some memory
  * @length: requested length of the data
  * @size: size of the data (could be greater than length)
+ * @deadline: TX only, time after which the block must not be sent
+ * anymore, 0 if none
+ * @headroom: number of bytes allocated before @data
+ * @pool: size class + 1 of the pool @data comes from, 0 if it was
+ * allocated with kmalloc()
+ * @work: TX work queuing the block, owned by the HSSPI driver from
+ * hsspi_send() to &struct hsspi_layer_ops.sent
  *
  * This structure represents the memory used by the HSSPI driver for
  * sending or receiving message. Upper layer must provides the HSSPI
@@ -67,14 +275,56 @@ enum hsspi_work_type {
  * structure for sending function.
  *
  * The goal here is to prevent useless copy.
+ *
+ * Queued blocks of a same upper layer are sent earliest deadline
+ * first, blocks without deadline are sent after them in FIFO order. A
+ * block whose deadline has passed is not sent and is given back with
+ * the -ETIME status.
+ *
+ * Blocks allocated by hsspi_init_block() have HSSPI_HEADROOM bytes
+ * before @data so that, in contiguous mode, the STC header and the
+ * payload are sent in a single transfer from a single buffer.
+ *
+ * As @work is embedded, queuing a block never allocates memory and
+ * never fails for lack of resources, but a block must not be sent again
+ * before being given back.
  */
 struct hsspi_block {
 	void *data;
 	u16 length;
 	u16 size;
+	ktime_t deadline;
+	u8 headroom;
+	u8 pool;
+	struct hsspi_work work;
 };
 
-struct hsspi_layer;
+/**
+ * enum hsspi_layout - How a STC transaction is clocked
+ * @HSSPI_LAYOUT_SPLIT: header then payload, two transfers
+ * @HSSPI_LAYOUT_CONTIGUOUS: header and payload in a single transfer
+ * @HSSPI_LAYOUT_DUPLEX: full-duplex write, two messages under the bus
+ * lock
+ * @HSSPI_LAYOUT_MAX: number of layouts
+ */
+enum hsspi_layout {
+	HSSPI_LAYOUT_SPLIT,
+	HSSPI_LAYOUT_CONTIGUOUS,
+	HSSPI_LAYOUT_DUPLEX,
+	HSSPI_LAYOUT_MAX
+};
+
+/**
+ * struct hsspi_xfer_stats - Controller overhead of STC transactions
+ * @frames: number of transactions
+ * @overhead_ns: total time spent outside of the clocked bits
+ * @max_overhead_ns: maximum of the above for a single transaction
+ */
+struct hsspi_xfer_stats {
+	u64 frames;
+	u64 overhead_ns;
+	u64 max_overhead_ns;
+};
 
 /**
  * struct hsspi_layer_ops - Upper layer operations.
@@ -84,7 +334,8 @@ struct hsspi_layer;
  *
  * @get: Called when the HSSPI driver need some memory for
  * reception. This &struct hsspi_block will be give back to the upper
- * layer in the received callback.
+ * layer in the received callback. @gfp is GFP_KERNEL from the HSSPI
+ * thread and GFP_ATOMIC from the asynchronous engine.
  *
  * @received: Called when the HSSPI driver received some data for this
  * upper layer. In case of error, status is used to notify the upper
@@ -95,12 +346,17 @@ struct hsspi_layer;
  *
  * Operation needed to be implemented by an upper layer. All ops are
  * called by the HSSPI driver and are mandatory.
+ *
+ * @get, @received and @sent are called from the HSSPI thread, or in
+ * atomic context by the asynchronous engine if &struct
+ * hsspi_layer.atomic_ops is set. They must then not sleep.
  */
 struct hsspi_layer_ops {
 	int (*registered)(struct hsspi_layer *upper_layer);
 	void (*unregistered)(struct hsspi_layer *upper_layer);
 
-	struct hsspi_block *(*get)(struct hsspi_layer *upper_layer, u16 length);
+	struct hsspi_block *(*get)(struct hsspi_layer *upper_layer, u16 length,
+				   gfp_t gfp);
 	void (*received)(struct hsspi_layer *upper_layer,
 			 struct hsspi_block *blk, int status);
 	void (*sent)(struct hsspi_layer *upper_layer, struct hsspi_block *blk,
@@ -111,6 +367,10 @@ struct hsspi_layer_ops {
  * struct hsspi_layer - HSSPI upper layer.
  * @name: Name of this upper layer.
  * @id: id (ul used in the STC header) of this upper layer
+ * @coalesce: queued blocks may be concatenated in a single STC frame,
+ * the upper layer protocol on the QM35 side must be able to split them
+ * @atomic_ops: @ops may be called in atomic context, which allows the
+ * asynchronous engine to serve this layer without the HSSPI thread
  * @ops: &struct hsspi_layer_ops
  *
  * Basic upper layer structure. Inherit from it to implement a
@@ -119,6 +379,8 @@ struct hsspi_layer_ops {
 struct hsspi_layer {
 	char *name;
 	u8 id;
+	bool coalesce;
+	bool atomic_ops;
 	const struct hsspi_layer_ops *ops;
 };
 
@@ -126,7 +388,26 @@ enum hsspi_flags {
 	HSSPI_FLAGS_SS_IRQ = 0,
 	HSSPI_FLAGS_SS_READY = 1,
 	HSSPI_FLAGS_SS_BUSY = 2,
-	HSSPI_FLAGS_MAX = 3,
+	HSSPI_FLAGS_ASYNC = 3,
+	HSSPI_FLAGS_FALLBACK = 4,
+	HSSPI_FLAGS_ASYNC_WAIT = 5,
+	HSSPI_FLAGS_RX_THROTTLED = 6,
+	HSSPI_FLAGS_SS_IRQ_DEFERRED = 7,
+	HSSPI_FLAGS_DUPLEX_FW = 8,
+	HSSPI_FLAGS_DUPLEX_NO_FW = 9,
+	HSSPI_FLAGS_MAX = 10,
+};
+
+/**
+ * enum hsspi_duplex_mode - Full-duplex writes, see &struct hsspi
+ * @HSSPI_DUPLEX_OFF: never
+ * @HSSPI_DUPLEX_AUTO: unless the controller or the firmware can't
+ * @HSSPI_DUPLEX_FORCE: always, overriding the checks
+ */
+enum hsspi_duplex_mode {
+	HSSPI_DUPLEX_OFF = 0,
+	HSSPI_DUPLEX_AUTO,
+	HSSPI_DUPLEX_FORCE,
 };
 
 enum hsspi_state {
@@ -135,19 +416,120 @@ enum hsspi_state {
 	HSSPI_STOPPED = 2,
 };
 
+enum hsspi_async_phase {
+	HSSPI_ASYNC_TX = 0,
+	HSSPI_ASYNC_PRE_READ,
+	HSSPI_ASYNC_RX,
+};
+
+/**
+ * struct hsspi_async - Asynchronous engine context
+ * @timer: ss_ready timeout, hands the job over to the HSSPI thread
+ * @msg: SPI message in flight, see hsspi_msg()
+ * @phase: &enum hsspi_async_phase of @msg
+ * @work: work taken from the queues but not handled yet
+ * @batch: TX works sent by @msg
+ * @layer: upper layer of @batch
+ * @length: frame length of @batch
+ * @rx_pending: a RX transaction must be done for @rx_ul and @rx_length
+ * @rx_ul: upper layer id announced by the QM35
+ * @rx_length: length announced by the QM35
+ * @rx_layer: upper layer receiving @rx_blk
+ * @rx_blk: block receiving the data of @msg
+ * @reset: the HSSPI thread must dump the flight recorder and reset the
+ * QM35
+ * @wait_start: time at which the engine started waiting for ss_ready,
+ * 0 if not waiting
+ * @wait_ns: ss_ready wait before @msg
+ * @start: submission time of @msg
+ * @xfers_count: number of transactions done by the engine
+ * @fallbacks: number of jobs handed over to the HSSPI thread
+ *
+ * The engine chains the STC transactions from the spi_async()
+ * completions, started from hsspi_send() or the ss_ready/ss_irq
+ * handlers. The HSSPI thread only takes over what can't be done in
+ * atomic context: layers without &struct hsspi_layer.atomic_ops,
+ * ss_ready timeouts, transfer errors and resets. Full-duplex and
+ * coalescing delay are left to the thread.
+ *
+ * Everything but the counters is owned by whoever holds the
+ * HSSPI_FLAGS_ASYNC bit.
+ */
+struct hsspi_async {
+	struct timer_list timer;
+	struct spi_message *msg;
+	enum hsspi_async_phase phase;
+	struct hsspi_work *work;
+	struct list_head batch;
+	struct hsspi_layer *layer;
+	u16 length;
+	bool rx_pending;
+	u8 rx_ul;
+	u16 rx_length;
+	struct hsspi_layer *rx_layer;
+	struct hsspi_block *rx_blk;
+	bool reset;
+	ktime_t wait_start;
+	s64 wait_ns;
+	ktime_t start;
+	u64 xfers_count;
+	u64 fallbacks;
+};
+
 /**
  * struct hsspi - HSSPI driver.
+ * @queues: TX queue of each upper layer
+ * @ctrl_queue: COMPLETION works of hsspi_stop(), served once all the
+ * upper layer queues are empty
+ * @starvation_limit: number of times a non-empty queue can be passed
+ * over by higher priority ones
+ * @works: accounting of the queued blocks
+ * @hdr_msg: persistent message of the header only transactions
+ * @hdr_xfer: the transfer of @hdr_msg
+ * @hdr_msg_optimized: @hdr_msg was validated and prepared once by the
+ * controller, see hsspi_init_msgs()
+ * @frame_msg: message of the other transactions, rebuilt for each one
+ * @frame_xfers: the transfers of @frame_msg
+ * @tx_frame: frame of the coalesced blocks, with some headroom
+ * @rx_frame: RX counterpart of @tx_frame
+ * @coalesce_delay_us: maximum wait for more blocks of a coalescing
+ * layer after the first one was queued
+ * @full_duplex: &enum hsspi_duplex_mode
+ * @duplex_ctlr: the controller keeps CS active between two messages
+ * @duplex_misses: full-duplex writes not acknowledged by the firmware
+ * @duplex_merged: number of full-duplex writes which read a frame
+ * @duplex_rx: frame read by the last full-duplex write
+ * @async_engine: chain the transactions from the spi_async()
+ * completions instead of the HSSPI thread, see &struct hsspi_async
+ * @async: context of the asynchronous engine
+ * @contiguous: send the frames with some headroom in a single transfer
+ * @xfer_stats: controller overhead per &enum hsspi_layout
+ * @sched_prio: SCHED_FIFO priority of the HSSPI thread, 0 for
+ * SCHED_NORMAL
+ * @sched_cpus: CPUs the HSSPI thread runs on
+ * @ss_ready_spin_us: maximum busy-wait for ss_ready, 0 to always sleep
+ * @ss_ready_avg_ns: average of the recent ss_ready latencies, the spin
+ * budget is twice this average
+ * @ss_ready_stats: spin and sleep statistics of the ss_ready waits
+ * @latency: histogram per upper layer, the one of the STC host header
+ * or UL_RESERVED for pre-reads, and per &enum hsspi_phase
+ * @rec: flight recorder of the last STC transactions
+ * @speed_hz: SPI clock per upper layer and &enum hsspi_clk_phase, 0
+ * for the SPI device max_speed_hz, pre-reads always use the latter
+ * @throughput: payload throughput per upper layer, TX [0] and RX [1]
+ * @error_resets: number of QM35 resets after too many successive errors
  *
  * Some things need to be refine:
  * 1. a better way to disable/enable ss_irq or ss_ready GPIOs
- * 2. be able to change spi speed on the fly (for flashing purpose)
  *
  * Actually this structure should be abstract.
- *
  */
 struct hsspi {
-	spinlock_t lock; /* protect work_list, layers and state */
-	struct list_head work_list;
+	spinlock_t lock; /* protect layers and state */
+	struct hsspi_queue queues[UL_MAX_IDX];
+	struct hsspi_queue ctrl_queue;
+	u32 starvation_limit;
+	struct hsspi_work_stats works;
 	struct hsspi_layer *layers[UL_MAX_IDX];
 	enum hsspi_state state;
 
@@ -168,6 +550,38 @@ struct hsspi {
 	struct spi_device *spi;
 
 	struct stc_header *host, *soc;
+	struct spi_message hdr_msg;
+	struct spi_transfer hdr_xfer;
+	bool hdr_msg_optimized;
+	struct spi_message frame_msg;
+	struct spi_transfer frame_xfers[2];
+	void *tx_frame;
+	void *rx_frame;
+	u32 coalesce_delay_us;
+	u32 full_duplex;
+	bool duplex_ctlr;
+	u8 duplex_misses;
+	u64 duplex_merged;
+	struct {
+		u8 ul;
+		u16 length;
+		bool done;
+	} duplex_rx;
+	bool async_engine;
+	struct hsspi_async async;
+	bool contiguous;
+	struct hsspi_xfer_stats xfer_stats[HSSPI_LAYOUT_MAX];
+	int sched_prio;
+	struct cpumask sched_cpus;
+	u32 ss_ready_spin_us;
+	u64 ss_ready_avg_ns;
+	struct hsspi_ss_ready_stats ss_ready_stats;
+	struct hsspi_hist latency[UL_MAX_IDX][HSSPI_PHASE_MAX];
+	struct hsspi_rec rec;
+	u32 speed_hz[UL_MAX_IDX][HSSPI_CLK_MAX];
+	struct hsspi_throughput throughput[UL_MAX_IDX][2];
+	int successive_errors;
+	u64 error_resets;
 	ktime_t next_cs_active_time;
 
 	struct gpio_desc *gpio_ss_rdy;
@@ -226,6 +640,91 @@ int hsspi_register(struct hsspi *hsspi, struct hsspi_layer *layer);
  */
 int hsspi_unregister(struct hsspi *hsspi, struct hsspi_layer *layer);
 
+/**
+ * hsspi_set_async() - select the engine driving the transfers
+ * @hsspi: pointer to a &struct hsspi
+ * @enable: true for the asynchronous engine, false for the HSSPI thread
+ *
+ * Must be called while the HSSPI is stopped, after hsspi_set_gpios().
+ *
+ * Return: 0 if no error or -EOPNOTSUPP if the GPIOs can't be accessed
+ * from atomic context.
+ */
+int hsspi_set_async(struct hsspi *hsspi, bool enable);
+
+/**
+ * hsspi_set_sched() - set the scheduling of the HSSPI thread
+ * @hsspi: pointer to a &struct hsspi
+ * @prio: SCHED_FIFO priority, 0 for SCHED_NORMAL
+ * @cpus: CPUs the thread is allowed to run on, NULL for all
+ *
+ * Nothing is changed on error.
+ *
+ * Return: 0 if no error or -errno.
+ */
+int hsspi_set_sched(struct hsspi *hsspi, int prio, const struct cpumask *cpus);
+
+/**
+ * hsspi_set_speed() - set the SPI clocks of an upper layer
+ * @hsspi: pointer to a &struct hsspi
+ * @ul: upper layer id
+ * @phase: &enum hsspi_clk_phase
+ * @speed_hz: SPI clock, 0 for the SPI device max_speed_hz
+ *
+ * Can be called at any time, applies to the next transactions.
+ *
+ * Return: 0 if no error or -EINVAL.
+ */
+int hsspi_set_speed(struct hsspi *hsspi, u8 ul, enum hsspi_clk_phase phase,
+		    u32 speed_hz);
+
+/**
+ * hsspi_rec_init() - allocate the flight recorder
+ * @hsspi: pointer to a &struct hsspi
+ * @len: number of entries, rounded up to a power of two, 0 to disable
+ *
+ * Must be called before hsspi_start(). The recorder is freed by
+ * hsspi_deinit().
+ *
+ * Return: 0 if no error or -errno.
+ */
+int hsspi_rec_init(struct hsspi *hsspi, unsigned int len);
+
+/**
+ * hsspi_rec_snapshot() - copy the flight recorder
+ * @hsspi: pointer to a &struct hsspi
+ * @entries: destination
+ * @len: length of @entries
+ *
+ * Return: the number of entries copied, oldest first.
+ */
+unsigned int hsspi_rec_snapshot(struct hsspi *hsspi,
+				struct hsspi_rec_entry *entries,
+				unsigned int len);
+
+/**
+ * hsspi_hist_add() - account a duration in a histogram
+ * @hist: &struct hsspi_hist
+ * @ns: duration in nanoseconds
+ */
+void hsspi_hist_add(struct hsspi_hist *hist, s64 ns);
+
+/**
+ * hsspi_hist_reset() - clear a histogram
+ * @hist: &struct hsspi_hist
+ */
+void hsspi_hist_reset(struct hsspi_hist *hist);
+
+/**
+ * hsspi_set_layer_prio() - set the TX priority of an upper layer
+ * @hsspi: pointer to a &struct hsspi
+ * @ul: upper layer id
+ * @prio: priority, 0 is the highest
+ *
+ * Return: 0 if no error or -EINVAL if ul is not a valid layer id.
+ */
+int hsspi_set_layer_prio(struct hsspi *hsspi, u8 ul, u8 prio);
+
 /**
  * hsspi_set_spi_slave_ready() - tell the hsspi that the ss_ready is active
  * @hsspi: pointer to a &struct hsspi
@@ -274,15 +773,44 @@ void hsspi_clear_spi_slave_busy(struct hsspi *hsspi);
  */
 void hsspi_set_output_data_waiting(struct hsspi *hsspi);
 
+/**
+ * hsspi_throttle_rx() - stop or resume reading the QM35
+ * @hsspi: pointer to a &struct hsspi
+ * @throttle: true to stop, false to resume
+ *
+ * While throttled, the ss_irq is not serviced: the QM35 keeps its data
+ * and the backpressure reaches the firmware. Blocks are still sent.
+ * Can be called from any context.
+ */
+void hsspi_throttle_rx(struct hsspi *hsspi, bool throttle);
+
+/**
+ * hsspi_pools_init() - create the pools of hsspi_init_block()
+ *
+ * Block data are taken from a mempool per size class, up to
+ * MAX_STC_FRAME_LEN, with a reserve that guarantees forward progress
+ * under memory pressure. Bigger blocks are kmalloc()ed.
+ *
+ * Return: 0 or -ENOMEM on error
+ */
+int hsspi_pools_init(void);
+
+/**
+ * hsspi_pools_exit() - destroy the pools of hsspi_init_block()
+ */
+void hsspi_pools_exit(void);
+
 /**
  * hsspi_init_block() - allocate a block data that suits HSSPI.
  *
  * @blk: point to a &struct hsspi_block
  * @length: block length
+ * @gfp: allocation flags, GFP_ATOMIC if called from an upper layer
+ * operation of a layer with &struct hsspi_layer.atomic_ops set
  *
  * Return: 0 or -ENOMEM on error
  */
-int hsspi_init_block(struct hsspi_block *blk, u16 length);
+int hsspi_init_block(struct hsspi_block *blk, u16 length, gfp_t gfp);
 
 /**
  * hsspi_deinit_block() - deallocate a block data.
@@ -301,7 +829,8 @@ void hsspi_deinit_block(struct hsspi_block *blk);
  * @blk: pointer to a &struct hsspi_block
  *
  * Send the block `blk` of the upper layer `layer` on the `hsspi`
- * driver.
+ * driver. It never sleeps nor allocates memory and can be called from
+ * atomic context.
  *
  * Return: 0 if no error or -errno.
  *
@@ -309,6 +838,24 @@ void hsspi_deinit_block(struct hsspi_block *blk);
 int hsspi_send(struct hsspi *hsspi, struct hsspi_layer *layer,
 	       struct hsspi_block *blk);
 
+/**
+ * hsspi_send_batch() - send several &struct hsspi_block at once
+ *
+ * @hsspi: pointer to a &struct hsspi
+ * @layer: pointer to a &struct hsspi_layer
+ * @blks: blocks to send, in order
+ * @n: number of blocks
+ *
+ * Same as hsspi_send() for all the blocks, which are queued in order
+ * without any block of another sender in between, so that the blocks
+ * of a coalescing layer can share STC frames. Either all the blocks or
+ * none of them are queued.
+ *
+ * Return: 0 if no error or -errno.
+ */
+int hsspi_send_batch(struct hsspi *hsspi, struct hsspi_layer *layer,
+		     struct hsspi_block **blks, int n);
+
 /**
  * hsspi_start() - start the HSSPI
  *
@@ -52,16 +52,29 @@ struct __packed coredump_rcv_status {
 	uint8_t ack;
 };
 
+static struct kmem_cache *coredump_packet_cache;
+
+int coredump_packet_cache_init(void)
+{
+	coredump_packet_cache = KMEM_CACHE(coredump_packet, 0);
+	return coredump_packet_cache ? 0 : -ENOMEM;
+}
+
+void coredump_packet_cache_exit(void)
+{
+	kmem_cache_destroy(coredump_packet_cache);
+}
+
 struct coredump_packet *coredump_packet_alloc(u16 length)
 {
 	struct coredump_packet *p;
 
-	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	p = kmem_cache_zalloc(coredump_packet_cache, GFP_KERNEL);
 	if (!p)
 		return NULL;
 
-	if (hsspi_init_block(&p->blk, length)) {
-		kfree(p);
+	if (hsspi_init_block(&p->blk, length, GFP_KERNEL)) {
+		kmem_cache_free(coredump_packet_cache, p);
 		return NULL;
 	}
 	return p;
@@ -70,7 +83,7 @@ struct coredump_packet *coredump_packet_alloc(u16 length)
 void coredump_packet_free(struct coredump_packet *p)
 {
 	hsspi_deinit_block(&p->blk);
-	kfree(p);
+	kmem_cache_free(coredump_packet_cache, p);
 }
 
 static int coredump_send_rcv_status(struct coredump_layer *layer, uint8_t ack)
@@ -79,6 +92,7 @@ static int coredump_send_rcv_status(struct coredump_layer *layer, uint8_t ack)
 	struct coredump_common_hdr hdr;
 	struct coredump_rcv_status rcv;
 	struct qm35_ctx *qm35_hdl;
+	int ret;
 
 	pr_info("qm35: coredump: sending status %s\n",
 		layer->coredump_status == COREDUMP_RCV_ACK ? "ACK" : "NACK");
@@ -95,8 +109,12 @@ static int coredump_send_rcv_status(struct coredump_layer *layer, uint8_t ack)
 	memcpy(p->blk.data, &hdr, sizeof(hdr));
 	memcpy(p->blk.data + sizeof(hdr), &rcv, sizeof(rcv));
 
-	return hsspi_send(&qm35_hdl->hsspi, &qm35_hdl->coredump_layer.hlayer,
-			  &p->blk);
+	ret = hsspi_send(&qm35_hdl->hsspi, &qm35_hdl->coredump_layer.hlayer,
+			 &p->blk);
+	if (ret)
+		coredump_packet_free(p);
+
+	return ret;
 }
 
 static uint16_t coredump_get_checksum(struct coredump_layer *layer)
@@ -134,7 +152,8 @@ static void coredump_unregistered(struct hsspi_layer *hlayer)
 	;
 }
 
-static struct hsspi_block *coredump_get(struct hsspi_layer *hlayer, u16 length)
+static struct hsspi_block *coredump_get(struct hsspi_layer *hlayer,
+					u16 length, gfp_t gfp)
 {
 	struct coredump_packet *p;
 
@@ -300,6 +319,7 @@ int debug_coredump_force(struct debug *dbg)
 	struct coredump_packet *p;
 	struct coredump_common_hdr hdr = { .cmd_id = COREDUMP_FORCE_CMD };
 	struct qm35_ctx *qm35_hdl;
+	int ret;
 
 	pr_info("qm35: force coredump");
 
@@ -311,8 +331,12 @@ int debug_coredump_force(struct debug *dbg)
 
 	memcpy(p->blk.data, &hdr, sizeof(hdr));
 
-	return hsspi_send(&qm35_hdl->hsspi, &qm35_hdl->coredump_layer.hlayer,
-			  &p->blk);
+	ret = hsspi_send(&qm35_hdl->hsspi, &qm35_hdl->coredump_layer.hlayer,
+			 &p->blk);
+	if (ret)
+		coredump_packet_free(p);
+
+	return ret;
 }
 
 static const struct debug_coredump_ops debug_coredump_ops = {
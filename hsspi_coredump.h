@@ -49,6 +49,9 @@ struct coredump_layer {
 	struct timer_list timer;
 };
 
+int coredump_packet_cache_init(void);
+void coredump_packet_cache_exit(void);
+
 int coredump_layer_init(struct coredump_layer *coredump, struct debug *debug);
 void coredump_layer_deinit(struct coredump_layer *coredump);
 
@@ -54,16 +54,29 @@ struct __packed log_level_get_cmd {
 	uint8_t id;
 };
 
+static struct kmem_cache *log_packet_cache;
+
+int log_packet_cache_init(void)
+{
+	log_packet_cache = KMEM_CACHE(log_packet, 0);
+	return log_packet_cache ? 0 : -ENOMEM;
+}
+
+void log_packet_cache_exit(void)
+{
+	kmem_cache_destroy(log_packet_cache);
+}
+
 struct log_packet *log_packet_alloc(u16 length)
 {
 	struct log_packet *p;
 
-	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	p = kmem_cache_zalloc(log_packet_cache, GFP_KERNEL);
 	if (!p)
 		return NULL;
 
-	if (hsspi_init_block(&p->blk, length)) {
-		kfree(p);
+	if (hsspi_init_block(&p->blk, length, GFP_KERNEL)) {
+		kmem_cache_free(log_packet_cache, p);
 		return NULL;
 	}
 	return p;
@@ -72,7 +85,7 @@ struct log_packet *log_packet_alloc(u16 length)
 void log_packet_free(struct log_packet *p)
 {
 	hsspi_deinit_block(&p->blk);
-	kfree(p);
+	kmem_cache_free(log_packet_cache, p);
 }
 
 static struct log_packet *encode_get_log_sources_packet(void)
@@ -194,7 +207,8 @@ static void log_unregistered(struct hsspi_layer *hlayer)
 	;
 }
 
-static struct hsspi_block *log_get(struct hsspi_layer *hlayer, u16 length)
+static struct hsspi_block *log_get(struct hsspi_layer *hlayer, u16 length,
+				   gfp_t gfp)
 {
 	struct log_packet *p;
 
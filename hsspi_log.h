@@ -46,6 +46,18 @@ struct log_layer {
 	bool enabled;
 };
 
+/**
+ * log_packet_cache_init() - create the kmem_cache of the LOG packets
+ *
+ * Return: 0 or -ENOMEM on error
+ */
+int log_packet_cache_init(void);
+
+/**
+ * log_packet_cache_exit() - destroy the kmem_cache of the LOG packets
+ */
+void log_packet_cache_exit(void);
+
 /**
  * log_packet_alloc() - Allocate an LOG packet
  * @length: length of the LOG packet
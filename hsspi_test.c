@@ -28,12 +28,15 @@
 
 #include "hsspi_test.h"
 #include "hsspi_uci.h"
+#include <linux/completion.h>
+#include <linux/mutex.h>
 #include <linux/printk.h>
 #include <linux/delay.h>
 
 int hsspi_test_registered(struct hsspi_layer *upper_layer);
 void hsspi_test_unregistered(struct hsspi_layer *upper_layer);
-struct hsspi_block *hsspi_test_get(struct hsspi_layer *upper_layer, u16 length);
+struct hsspi_block *hsspi_test_get(struct hsspi_layer *upper_layer, u16 length,
+				   gfp_t gfp);
 void hsspi_test_received(struct hsspi_layer *upper_layer,
 			 struct hsspi_block *blk, int status);
 void hsspi_test_sent(struct hsspi_layer *upper_layer, struct hsspi_block *blk,
@@ -57,6 +60,25 @@ static struct hsspi *ghsspi;
 int sleep_inter_frame_ms;
 extern int test_sleep_after_ss_ready_us;
 
+/* echoes are checked by the calibration instead of being sent back */
+static DEFINE_MUTEX(calib_lock);
+static struct {
+	bool active;
+	u32 seq;
+	struct completion echo;
+	atomic_t errors;
+	atomic_t echoes;
+	struct hsspi_test_calib result;
+} calib;
+
+/* header of the calibration frames, followed by the check_rx() pattern,
+ * only compared to what was sent, in host order
+ */
+struct calib_hdr {
+	u32 magic;
+	u32 seq;
+} __packed;
+
 int hsspi_test_init(struct hsspi *hsspi)
 {
 	ghsspi = hsspi;
@@ -93,9 +115,10 @@ static int check_rx(const u8 *rx, int len)
 	return err;
 }
 
-struct hsspi_block *hsspi_test_get(struct hsspi_layer *layer, u16 length)
+struct hsspi_block *hsspi_test_get(struct hsspi_layer *layer, u16 length,
+				   gfp_t gfp)
 {
-	struct hsspi_block *blk = kzalloc(sizeof(*blk) + length, GFP_KERNEL);
+	struct hsspi_block *blk = kzalloc(sizeof(*blk) + length, gfp);
 	if (blk) {
 		blk->data = blk + 1;
 		blk->size = length;
@@ -109,13 +132,58 @@ void hsspi_test_set_inter_frame_ms(int ms)
 	sleep_inter_frame_ms = ms;
 }
 
+/**
+ * calib_received() - handle the echo of a calibration frame
+ *
+ * @blk: received block
+ * @status: status of the reception
+ *
+ * Echoes of an earlier frame, or received after the calibration, are
+ * dropped. While calibrating, a frame with the calibration length but
+ * not the calibration header is a corrupted echo.
+ *
+ * Return: true if @blk was consumed.
+ */
+static bool calib_received(struct hsspi_block *blk, int status)
+{
+	const struct calib_hdr *hdr = blk->data;
+	bool ours = blk->length == HSSPI_TEST_CALIB_FRAME_LEN &&
+		    hdr->magic == HSSPI_TEST_CALIB_MAGIC;
+	bool active = READ_ONCE(calib.active);
+
+	if (!ours && !(active && blk->length == HSSPI_TEST_CALIB_FRAME_LEN))
+		return false;
+
+	if (ours && hdr->seq != READ_ONCE(calib.seq)) {
+		/* late echo */
+		kfree(blk);
+		return true;
+	}
+
+	if (active) {
+		if (status || !ours ||
+		    check_rx(blk->data + sizeof(*hdr),
+			     blk->length - sizeof(*hdr)))
+			atomic_inc(&calib.errors);
+		atomic_inc(&calib.echoes);
+		complete(&calib.echo);
+	}
+	kfree(blk);
+	return true;
+}
+
 void hsspi_test_received(struct hsspi_layer *layer, struct hsspi_block *blk,
 			 int status)
 {
 	static uint64_t bytes, msgs, errors, bytes0, msgs0, errors0;
 	static time64_t last_perf_dump;
-	int error = check_rx(blk->data, blk->length) ? 1 : 0;
+	int error;
 	time64_t now;
+
+	if (calib_received(blk, status))
+		return;
+
+	error = check_rx(blk->data, blk->length) ? 1 : 0;
 	errors += error;
 
 	if (!last_perf_dump) {
@@ -175,3 +243,142 @@ void hsspi_test_sent(struct hsspi_layer *layer, struct hsspi_block *blk,
 			bytes, msgs, errors);
 	kfree(blk);
 }
+
+/**
+ * calib_run() - exchange the calibration frames at one clock
+ *
+ * @hsspi: &struct hsspi
+ * @first: first step of the calibration
+ *
+ * Each frame has its own sequence number so that a late echo is not
+ * taken for the one of the next frame.
+ *
+ * Return: the number of corrupted or missing echoes, or -EOPNOTSUPP if
+ * the first frame of the first step was not echoed at all.
+ */
+static int calib_run(struct hsspi *hsspi, bool first)
+{
+	struct hsspi_block *blk;
+	struct calib_hdr *hdr;
+	int i, j;
+
+	atomic_set(&calib.errors, 0);
+
+	for (i = 0; i < HSSPI_TEST_CALIB_FRAMES; i++) {
+		blk = hsspi_test_get(&test_hsspi_layer,
+				     HSSPI_TEST_CALIB_FRAME_LEN, GFP_KERNEL);
+		if (!blk)
+			return HSSPI_TEST_CALIB_FRAMES;
+
+		hdr = blk->data;
+		hdr->magic = HSSPI_TEST_CALIB_MAGIC;
+		WRITE_ONCE(calib.seq, calib.seq + 1);
+		hdr->seq = calib.seq;
+		for (j = 0; j < blk->length - sizeof(*hdr); j++)
+			((u8 *)(hdr + 1))[j] = j & 0xff;
+
+		atomic_set(&calib.echoes, 0);
+		reinit_completion(&calib.echo);
+
+		if (hsspi_send(hsspi, &test_hsspi_layer, blk)) {
+			kfree(blk);
+			atomic_inc(&calib.errors);
+			continue;
+		}
+
+		if (!wait_for_completion_timeout(&calib.echo,
+						 msecs_to_jiffies(100))) {
+			if (first && !i && !atomic_read(&calib.echoes))
+				return -EOPNOTSUPP;
+			atomic_inc(&calib.errors);
+		}
+	}
+
+	return atomic_read(&calib.errors);
+}
+
+int hsspi_test_calibrate(struct hsspi *hsspi, u32 ul_mask, u32 min_hz,
+			 u32 max_hz, u32 step_hz)
+{
+	struct hsspi_test_calib *res = &calib.result;
+	bool update[UL_MAX_IDX][HSSPI_CLK_MAX];
+	u32 saved[HSSPI_CLK_MAX];
+	u32 hz, best = 0;
+	int ul, phase, ret = 0;
+
+	if (!min_hz || !step_hz || max_hz < min_hz)
+		return -EINVAL;
+
+	if (READ_ONCE(hsspi->state) != HSSPI_RUNNING)
+		return -EAGAIN;
+
+	mutex_lock(&calib_lock);
+
+	/* decided before the sweep, which changes the test layer clocks */
+	for (ul = 0; ul < UL_MAX_IDX; ul++)
+		for (phase = 0; phase < HSSPI_CLK_MAX; phase++)
+			update[ul][phase] =
+				ul_mask ? !!(ul_mask & BIT(ul)) :
+					  !READ_ONCE(hsspi->speed_hz[ul][phase]);
+	for (phase = 0; phase < HSSPI_CLK_MAX; phase++)
+		saved[phase] = READ_ONCE(hsspi->speed_hz[UL_TEST_HSSPI][phase]);
+
+	init_completion(&calib.echo);
+	memset(res, 0, sizeof(*res));
+	WRITE_ONCE(calib.active, true);
+
+	for (hz = min_hz; hz <= max_hz && res->steps < ARRAY_SIZE(res->errors);
+	     hz += step_hz) {
+		for (phase = 0; phase < HSSPI_CLK_MAX; phase++)
+			hsspi_set_speed(hsspi, UL_TEST_HSSPI, phase, hz);
+
+		ret = calib_run(hsspi, !res->steps);
+		if (ret < 0)
+			break;
+
+		res->tested_hz[res->steps] = hz;
+		res->errors[res->steps++] = ret;
+		if (ret)
+			break;
+
+		best = hz;
+	}
+
+	/* late echoes no longer match the sequence number */
+	WRITE_ONCE(calib.seq, calib.seq + 1);
+	WRITE_ONCE(calib.active, false);
+
+	for (phase = 0; phase < HSSPI_CLK_MAX; phase++)
+		hsspi_set_speed(hsspi, UL_TEST_HSSPI, phase, saved[phase]);
+
+	if (ret == -EOPNOTSUPP) {
+		pr_warn("hsspi test: no echo, is the HSSPI test firmware running?\n");
+		goto unlock;
+	}
+
+	if (!best) {
+		pr_warn("hsspi test: no SPI clock passed, clocks unchanged\n");
+		ret = -EIO;
+		goto unlock;
+	}
+
+	res->speed_hz = best - best / 100 * HSSPI_TEST_CALIB_MARGIN_PCT;
+	for (ul = 0; ul < UL_MAX_IDX; ul++)
+		for (phase = 0; phase < HSSPI_CLK_MAX; phase++)
+			if (update[ul][phase])
+				hsspi_set_speed(hsspi, ul, phase,
+						res->speed_hz);
+
+	pr_info("hsspi test: calibrated SPI clock %u Hz (max passing %u Hz)\n",
+		res->speed_hz, best);
+	ret = res->speed_hz;
+
+unlock:
+	mutex_unlock(&calib_lock);
+	return ret;
+}
+
+const struct hsspi_test_calib *hsspi_test_get_calib(void)
+{
+	return &calib.result;
+}
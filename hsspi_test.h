@@ -31,9 +31,64 @@
 
 #include "hsspi.h"
 
+#define HSSPI_TEST_CALIB_MIN_HZ 1000000
+#define HSSPI_TEST_CALIB_STEP_HZ 1000000
+#define HSSPI_TEST_CALIB_MAX_STEPS 64
+#define HSSPI_TEST_CALIB_FRAMES 16
+#define HSSPI_TEST_CALIB_FRAME_LEN 256
+#define HSSPI_TEST_CALIB_MARGIN_PCT 10
+#define HSSPI_TEST_CALIB_MAGIC 0x424c4143 /* "CALB" */
+
+/**
+ * struct hsspi_test_calib - Result of a SPI clock calibration
+ * @speed_hz: selected clock, 0 if no clock passed
+ * @steps: number of clocks tested
+ * @tested_hz: clocks tested, in increasing order
+ * @errors: number of failed echoes for each of @tested_hz
+ */
+struct hsspi_test_calib {
+	u32 speed_hz;
+	int steps;
+	u32 tested_hz[HSSPI_TEST_CALIB_MAX_STEPS];
+	u32 errors[HSSPI_TEST_CALIB_MAX_STEPS];
+};
+
 int hsspi_test_init(struct hsspi *hsspi);
 void hsspi_test_deinit(struct hsspi *hsspi);
 
 void hsspi_test_set_inter_frame_ms(int ms);
 
+/**
+ * hsspi_test_calibrate() - find the highest reliable SPI clock
+ * @hsspi: pointer to a &struct hsspi
+ * @ul_mask: BIT() of the upper layers to apply the clock to, 0 for the
+ * upper layer clocks still set to the default one
+ * @min_hz: first clock tested
+ * @max_hz: last clock tested
+ * @step_hz: increment between two clocks
+ *
+ * Needs a started HSSPI and a QM35 running the HSSPI test firmware,
+ * which must echo the test layer frames sent by the host. The frames
+ * start with HSSPI_TEST_CALIB_MAGIC and a sequence number, followed by
+ * the usual test pattern. Clocks are tested in increasing order with
+ * HSSPI_TEST_CALIB_FRAMES frames each, up to the first one with a
+ * corrupted or missing echo. The selected clock is the highest one
+ * without error minus HSSPI_TEST_CALIB_MARGIN_PCT, it is applied with
+ * hsspi_set_speed(). On error, no clock is changed.
+ *
+ * Return: the selected clock, -EAGAIN if the HSSPI is not started,
+ * -EOPNOTSUPP if the first frame is not echoed, -EIO if no clock
+ * passed or -errno.
+ */
+int hsspi_test_calibrate(struct hsspi *hsspi, u32 ul_mask, u32 min_hz,
+			 u32 max_hz, u32 step_hz);
+
+/**
+ * hsspi_test_get_calib() - get the result of the last calibration
+ *
+ * Return: the result, &struct hsspi_test_calib.speed_hz is 0 if there
+ * was none.
+ */
+const struct hsspi_test_calib *hsspi_test_get_calib(void);
+
 #endif /* __HSSPI_TEST_H___ */
\ No newline at end of file
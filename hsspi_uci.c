@@ -26,31 +26,60 @@
  * QM35 UCI layer HSSPI Protocol
  */
 
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+
 #include "qm35.h"
 #include "hsspi_uci.h"
+#include "uci_ioctls.h"
+
+static struct kmem_cache *uci_packet_cache;
+
+int uci_packet_cache_init(void)
+{
+	uci_packet_cache = KMEM_CACHE(uci_packet, 0);
+	return uci_packet_cache ? 0 : -ENOMEM;
+}
 
-struct uci_packet *uci_packet_alloc(u16 length)
+void uci_packet_cache_exit(void)
+{
+	kmem_cache_destroy(uci_packet_cache);
+}
+
+struct uci_packet *uci_packet_alloc(u16 length, gfp_t gfp)
 {
 	struct uci_packet *p;
 
-	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	p = kmem_cache_zalloc(uci_packet_cache, gfp);
 	if (!p)
 		return NULL;
 
-	if (hsspi_init_block(&p->blk, length)) {
-		kfree(p);
+	if (hsspi_init_block(&p->blk, length, gfp)) {
+		kmem_cache_free(uci_packet_cache, p);
 		return NULL;
 	}
 
 	p->data = p->blk.data;
 	p->length = p->blk.length;
+	refcount_set(&p->ref, 1);
 	return p;
 }
 
 void uci_packet_free(struct uci_packet *p)
 {
+	struct uci_packet *parent = p->parent;
+
+	if (parent) {
+		kmem_cache_free(uci_packet_cache, p);
+		p = parent;
+	}
+
+	if (!refcount_dec_and_test(&p->ref))
+		return;
+
 	hsspi_deinit_block(&p->blk);
-	kfree(p);
+	kmem_cache_free(uci_packet_cache, p);
 }
 
 static int uci_registered(struct hsspi_layer *layer)
@@ -58,11 +87,127 @@ static int uci_registered(struct hsspi_layer *layer)
 	return 0;
 }
 
+/* UCI message type, found in the first byte of the header */
+#define UCI_MT(header) (((header)[0] >> 5) & 0x07)
+#define UCI_MT_RESPONSE 2
+
+static bool uci_is_response(const struct uci_packet *p)
+{
+	return p->length && UCI_MT(p->data) == UCI_MT_RESPONSE;
+}
+
+static bool uci_rx_over_budget(struct uci_layer *uci, u16 length)
+{
+	const struct qm35_rx_budget *budget = &uci->budget;
+
+	return (budget->max_packets &&
+		uci->rx_packets + 1 > budget->max_packets) ||
+	       (budget->max_bytes &&
+		uci->rx_bytes + length > budget->max_bytes);
+}
+
+/* must be called with uci->lock held */
+static void uci_rx_drop(struct uci_layer *uci, struct uci_packet *p,
+			bool queued)
+{
+	if (queued) {
+		list_del(&p->list);
+		uci->rx_packets--;
+		uci->rx_bytes -= p->length;
+	}
+	uci->rx_dropped[p->length ? UCI_MT(p->data) : 0]++;
+	uci->rx_lost = true;
+	uci_packet_free(p);
+}
+
+/**
+ * uci_rx_queue() - add a received packet to the rx_list
+ * @uci: pointer to &struct uci_layer
+ * @p: the received packet
+ *
+ * Apply the drop policy of the budget if the packet does not fit. The
+ * responses are never dropped: a command is always waiting for them.
+ *
+ * Must be called with uci->lock held.
+ */
+static void uci_rx_queue(struct uci_layer *uci, struct uci_packet *p)
+{
+	struct uci_packet *victim;
+	bool response = uci_is_response(p);
+
+	while (uci->budget.policy != QM35_RX_POLICY_BACKPRESSURE &&
+	       uci_rx_over_budget(uci, p->length)) {
+		victim = NULL;
+		if (uci->budget.policy == QM35_RX_POLICY_DROP_OLDEST) {
+			list_for_each_entry(victim, &uci->rx_list, list) {
+				if (!uci_is_response(victim))
+					break;
+			}
+			if (list_entry_is_head(victim, &uci->rx_list, list))
+				victim = NULL;
+		}
+		if (victim) {
+			uci_rx_drop(uci, victim, true);
+			continue;
+		}
+		if (response)
+			break;
+		uci_rx_drop(uci, p, false);
+		return;
+	}
+
+	list_add_tail(&p->list, &uci->rx_list);
+	uci->rx_packets++;
+	uci->rx_bytes += p->length;
+}
+
+/*
+ * Stop or restart the HSSPI reads when the backpressure policy is used and
+ * the rx_list crosses its budget.
+ *
+ * hsspi_throttle_rx() can't be called under uci->lock: resuming may run
+ * the asynchronous engine inline, down to uci_get(). A single caller
+ * applies the state at a time and checks the budget again if another one
+ * came meanwhile, so the last state applied is always the current one.
+ */
+static void uci_rx_update_throttle(struct uci_layer *uci)
+{
+	struct qm35_ctx *qm35_hdl =
+		container_of(uci, struct qm35_ctx, uci_layer);
+	unsigned long flags;
+	bool throttle;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	if (uci->rx_throttle_busy) {
+		uci->rx_throttle_recheck = true;
+		spin_unlock_irqrestore(&uci->lock, flags);
+		return;
+	}
+	uci->rx_throttle_busy = true;
+
+	do {
+		uci->rx_throttle_recheck = false;
+		throttle = uci->budget.policy == QM35_RX_POLICY_BACKPRESSURE &&
+			   uci_rx_over_budget(uci, 0);
+		if (throttle == uci->rx_throttled)
+			continue;
+
+		uci->rx_throttled = throttle;
+		spin_unlock_irqrestore(&uci->lock, flags);
+		hsspi_throttle_rx(&qm35_hdl->hsspi, throttle);
+		spin_lock_irqsave(&uci->lock, flags);
+	} while (uci->rx_throttle_recheck);
+
+	uci->rx_throttle_busy = false;
+	spin_unlock_irqrestore(&uci->lock, flags);
+}
+
 static void clear_rx_list(struct uci_layer *uci)
 {
 	struct uci_packet *p;
+	unsigned long flags;
 
-	mutex_lock(&uci->lock);
+	spin_lock_irqsave(&uci->lock, flags);
 
 	while (!list_empty(&uci->rx_list)) {
 		p = list_first_entry(&uci->rx_list, struct uci_packet, list);
@@ -71,9 +216,12 @@ static void clear_rx_list(struct uci_layer *uci)
 
 		uci_packet_free(p);
 	}
+	uci->rx_packets = 0;
+	uci->rx_bytes = 0;
 
-	mutex_unlock(&uci->lock);
+	spin_unlock_irqrestore(&uci->lock, flags);
 
+	uci_rx_update_throttle(uci);
 	wake_up_interruptible(&uci->wq);
 }
 
@@ -84,11 +232,157 @@ static void uci_unregistered(struct hsspi_layer *hlayer)
 	clear_rx_list(uci);
 }
 
-static struct hsspi_block *uci_get(struct hsspi_layer *hlayer, u16 length)
+static void uci_ring_free(struct kref *ref)
+{
+	struct uci_ring *ring = container_of(ref, struct uci_ring, ref);
+
+	vfree(ring->mem);
+	kfree(ring->pkts);
+	kfree(ring);
+}
+
+static void uci_rx_split(struct uci_layer *uci, struct uci_packet *p);
+
+static struct qm35_rx_slot *uci_ring_slot(struct uci_ring *ring, u32 pos)
+{
+	return ring->mem + ring->hdr->data_offset +
+	       (pos & (ring->count - 1)) * QM35_RX_SLOT_SIZE;
+}
+
+/**
+ * uci_ring_get() - hand out the next free slot of the RX ring
+ * @uci: pointer to &struct uci_layer
+ * @length: length of the packet to receive
+ *
+ * Packets go to the ring only while the rx_list is empty, to keep the
+ * order for a reader consuming the ring before calling read().
+ *
+ * Return: the &struct uci_packet of the slot or NULL.
+ */
+static struct uci_packet *uci_ring_get(struct uci_layer *uci, u16 length)
+{
+	struct qm35_rx_slot *slot;
+	struct uci_packet *p = NULL;
+	struct uci_ring *ring;
+	unsigned long flags;
+	u32 pos;
+
+	BUILD_BUG_ON(HSSPI_HEADROOM > sizeof(slot->reserved));
+
+	if (length > QM35_RX_SLOT_SIZE - sizeof(*slot))
+		return NULL;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	ring = uci->ring;
+	if (ring && list_empty(&uci->rx_list) &&
+	    ring->next - READ_ONCE(ring->hdr->tail) < ring->count) {
+		pos = ring->next++;
+		kref_get(&ring->ref);
+		p = &ring->pkts[pos & (ring->count - 1)];
+	}
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	if (!p)
+		return NULL;
+
+	slot = uci_ring_slot(ring, pos);
+	p->ring = ring;
+	p->blk.data = slot->data;
+	p->blk.headroom = HSSPI_HEADROOM;
+	p->blk.length = length;
+	p->blk.size = length;
+	return p;
+}
+
+/* length of the first UCI packet of @data, the rest if truncated */
+static size_t uci_split_len(const u8 *data, size_t length)
+{
+	if (length < UCI_PACKET_HEADER_SIZE)
+		return length;
+
+	return min(uci_packet_size(data), length);
+}
+
+/**
+ * uci_ring_received() - publish a slot of the RX ring
+ * @uci: pointer to &struct uci_layer
+ * @p: &struct uci_packet of the slot
+ * @status: status of the reception
+ *
+ * The HSSPI receives one block at a time, so @p is always the last
+ * slot handed out: on error it is simply handed out again.
+ *
+ * The block may hold several UCI packets back to back: the first one
+ * stays in the slot, the next ones are copied to the following free
+ * slots. What does not fit in the ring goes to the rx_list, after the
+ * slots in the reading order.
+ */
+static void uci_ring_received(struct uci_layer *uci, struct uci_packet *p,
+			      int status)
+{
+	struct uci_ring *ring = p->ring;
+	struct qm35_rx_slot *slot, *next;
+	struct uci_packet *rest = NULL;
+	unsigned long flags;
+	size_t readn, len;
+	u32 pos;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	pos = ring->next - 1;
+	if (status) {
+		ring->next = pos;
+		spin_unlock_irqrestore(&uci->lock, flags);
+		kref_put(&ring->ref, uci_ring_free);
+		return;
+	}
+
+	slot = uci_ring_slot(ring, pos);
+	readn = uci_split_len(slot->data, p->blk.length);
+	slot->length = readn;
+	while (readn < p->blk.length &&
+	       ring->next - READ_ONCE(ring->hdr->tail) < ring->count) {
+		len = uci_split_len(slot->data + readn, p->blk.length - readn);
+		next = uci_ring_slot(ring, ring->next++);
+		memcpy(next->data, slot->data + readn, len);
+		next->length = len;
+		readn += len;
+	}
+	/* the slots must be complete before userspace sees them */
+	smp_store_release(&ring->hdr->head, ring->next);
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	/* no slot is handed out again before this function returns */
+	if (readn < p->blk.length) {
+		rest = uci_packet_alloc(p->blk.length - readn, GFP_ATOMIC);
+		if (rest) {
+			memcpy(rest->data, slot->data + readn, rest->length);
+		} else {
+			spin_lock_irqsave(&uci->lock, flags);
+			uci->rx_dropped[UCI_MT(slot->data + readn)]++;
+			uci->rx_lost = true;
+			spin_unlock_irqrestore(&uci->lock, flags);
+		}
+	}
+
+	kref_put(&ring->ref, uci_ring_free);
+
+	if (rest)
+		uci_rx_split(uci, rest);
+	else
+		wake_up_interruptible(&uci->wq);
+}
+
+static struct hsspi_block *uci_get(struct hsspi_layer *hlayer, u16 length,
+				   gfp_t gfp)
 {
+	struct uci_layer *uci = container_of(hlayer, struct uci_layer, hlayer);
 	struct uci_packet *p;
 
-	p = uci_packet_alloc(length);
+	p = uci_ring_get(uci, length);
+	if (p)
+		return &p->blk;
+
+	p = uci_packet_alloc(length, gfp);
 	if (!p)
 		return NULL;
 
@@ -98,10 +392,26 @@ static struct hsspi_block *uci_get(struct hsspi_layer *hlayer, u16 length)
 static void uci_sent(struct hsspi_layer *hlayer, struct hsspi_block *blk,
 		     int status)
 {
+	struct uci_layer *uci = container_of(hlayer, struct uci_layer, hlayer);
 	struct uci_packet *p = container_of(blk, struct uci_packet, blk);
+	struct uci_tx_budget *tx = p->tx;
+	struct completion *done = xchg(&p->write_done, NULL);
+
+	if (done) {
+		p->status = status;
+		complete(done);
+		return;
+	}
 
-	p->status = status;
-	complete(p->write_done);
+	if (status == -ETIME)
+		atomic_inc(&tx->deadline_missed);
+	/* reported by EPOLLERR and QM35_CTRL_GET_TX_ERROR */
+	if (status)
+		atomic_cmpxchg(&tx->error, 0, status);
+
+	uci_packet_free(p);
+	atomic_dec(&tx->inflight);
+	wake_up_interruptible(&uci->wq);
 }
 
 #define UCI_CONTROL_PACKET_PAYLOAD_SIZE_LOCATION (3)
@@ -117,7 +427,69 @@ static size_t get_payload_size_from_header(const u8 *header)
 	return (header[3] << 8) | header[2];
 }
 
-#define UCI_PACKET_HEADER_SIZE (4)
+size_t uci_packet_size(const u8 *header)
+{
+	return UCI_PACKET_HEADER_SIZE + get_payload_size_from_header(header);
+}
+
+/**
+ * uci_rx_split() - queue the UCI packets of a received block
+ * @uci: pointer to &struct uci_layer
+ * @p: the received packet, possibly several UCI packets back to back
+ *
+ * Each UCI packet but the last gets its own &struct uci_packet pointing
+ * into the block of @p.
+ */
+static void uci_rx_split(struct uci_layer *uci, struct uci_packet *p)
+{
+	struct hsspi_block *blk = &p->blk;
+	struct uci_packet *next;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	size_t readn = 0;
+	size_t payload_size;
+
+	while (1) {
+		if (blk->length - readn < UCI_PACKET_HEADER_SIZE)
+			// Incomplete UCI header
+			break;
+
+		payload_size =
+			get_payload_size_from_header((u8 *)blk->data + readn);
+
+		if (blk->length - readn <= UCI_PACKET_HEADER_SIZE + payload_size)
+			// blk contains no additional packet
+			break;
+
+		next = kmem_cache_zalloc(uci_packet_cache, GFP_ATOMIC);
+		if (!next)
+			break;
+
+		/* pins the block of p until next is freed */
+		refcount_inc(&p->ref);
+		next->parent = p;
+		next->data = p->blk.data + readn;
+		next->length = UCI_PACKET_HEADER_SIZE + payload_size;
+		next->timestamp = now;
+
+		readn += next->length;
+
+		spin_lock_irqsave(&uci->lock, flags);
+		uci_rx_queue(uci, next);
+		spin_unlock_irqrestore(&uci->lock, flags);
+	}
+
+	p->data = p->blk.data + readn;
+	p->length = p->blk.length - readn;
+	p->timestamp = now;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	uci_rx_queue(uci, p);
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	uci_rx_update_throttle(uci);
+	wake_up_interruptible(&uci->wq);
+}
 
 static void uci_received(struct hsspi_layer *hlayer, struct hsspi_block *blk,
 			 int status)
@@ -125,49 +497,12 @@ static void uci_received(struct hsspi_layer *hlayer, struct hsspi_block *blk,
 	struct uci_layer *uci = container_of(hlayer, struct uci_layer, hlayer);
 	struct uci_packet *p = container_of(blk, struct uci_packet, blk);
 
-	if (status)
+	if (p->ring)
+		uci_ring_received(uci, p, status);
+	else if (status)
 		uci_packet_free(p);
-	else {
-		struct uci_packet *next;
-		size_t readn = 0;
-		size_t payload_size;
-
-		while (1) {
-			if (blk->length - readn < UCI_PACKET_HEADER_SIZE)
-				// Incomplete UCI header
-				break;
-
-			payload_size = get_payload_size_from_header(
-				(u8 *)blk->data + readn);
-
-			if (blk->length - readn <=
-			    UCI_PACKET_HEADER_SIZE + payload_size)
-				// blk contains no additional packet
-				break;
-
-			next = kzalloc(sizeof(*next), GFP_KERNEL);
-			if (!next)
-				break;
-
-			next->data = p->blk.data + readn;
-			next->length = UCI_PACKET_HEADER_SIZE + payload_size;
-
-			readn += next->length;
-
-			mutex_lock(&uci->lock);
-			list_add_tail(&next->list, &uci->rx_list);
-			mutex_unlock(&uci->lock);
-		}
-
-		p->data = p->blk.data + readn;
-		p->length = p->blk.length - readn;
-
-		mutex_lock(&uci->lock);
-		list_add_tail(&p->list, &uci->rx_list);
-		mutex_unlock(&uci->lock);
-
-		wake_up_interruptible(&uci->wq);
-	}
+	else
+		uci_rx_split(uci, p);
 }
 
 static const struct hsspi_layer_ops uci_ops = {
@@ -182,10 +517,12 @@ int uci_layer_init(struct uci_layer *uci)
 {
 	uci->hlayer.name = "UCI";
 	uci->hlayer.id = UL_UCI_APP;
+	uci->hlayer.coalesce = true;
+	uci->hlayer.atomic_ops = true;
 	uci->hlayer.ops = &uci_ops;
 
 	INIT_LIST_HEAD(&uci->rx_list);
-	mutex_init(&uci->lock);
+	spin_lock_init(&uci->lock);
 	init_waitqueue_head(&uci->wq);
 	return 0;
 }
@@ -193,22 +530,145 @@ int uci_layer_init(struct uci_layer *uci)
 void uci_layer_deinit(struct uci_layer *uci)
 {
 	clear_rx_list(uci);
+	uci_layer_ring_release(uci, NULL);
+}
+
+void uci_layer_tx_drain(struct uci_layer *uci, struct uci_tx_budget *tx)
+{
+	wait_event(uci->wq, !atomic_read(&tx->inflight));
 }
 
 bool uci_layer_has_data_available(struct uci_layer *uci)
 {
+	unsigned long flags;
 	bool ret;
 
-	mutex_lock(&uci->lock);
+	spin_lock_irqsave(&uci->lock, flags);
 	ret = !list_empty(&uci->rx_list);
-	mutex_unlock(&uci->lock);
+	spin_unlock_irqrestore(&uci->lock, flags);
+	return ret;
+}
+
+bool uci_layer_ring_available(struct uci_layer *uci)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	if (uci->ring)
+		ret = READ_ONCE(uci->ring->hdr->head) !=
+		      READ_ONCE(uci->ring->hdr->tail);
+	spin_unlock_irqrestore(&uci->lock, flags);
 	return ret;
 }
 
+static void uci_ring_vm_open(struct vm_area_struct *vma)
+{
+	struct uci_ring *ring = vma->vm_private_data;
+
+	kref_get(&ring->ref);
+}
+
+static void uci_ring_vm_close(struct vm_area_struct *vma)
+{
+	struct uci_ring *ring = vma->vm_private_data;
+
+	kref_put(&ring->ref, uci_ring_free);
+}
+
+static const struct vm_operations_struct uci_ring_vm_ops = {
+	.open = uci_ring_vm_open,
+	.close = uci_ring_vm_close,
+};
+
+int uci_layer_mmap(struct uci_layer *uci, struct vm_area_struct *vma,
+		   const void *owner)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct uci_ring *ring;
+	unsigned long flags;
+	u32 count;
+	int ret;
+
+	if (vma->vm_pgoff || size <= PAGE_SIZE)
+		return -EINVAL;
+
+	count = (size - PAGE_SIZE) / QM35_RX_SLOT_SIZE;
+	if (!count)
+		return -EINVAL;
+	count = rounddown_pow_of_two(count);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->mem = vmalloc_user(size);
+	ring->pkts = kcalloc(count, sizeof(*ring->pkts), GFP_KERNEL);
+	if (!ring->mem || !ring->pkts) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	ring->hdr = ring->mem;
+	ring->hdr->slot_size = QM35_RX_SLOT_SIZE;
+	ring->hdr->slot_count = count;
+	ring->hdr->data_offset = PAGE_SIZE;
+	ring->count = count;
+	ring->owner = owner;
+	/* one reference for the layer, one for the mapping */
+	kref_init(&ring->ref);
+	kref_get(&ring->ref);
+
+	spin_lock_irqsave(&uci->lock, flags);
+	if (uci->ring) {
+		spin_unlock_irqrestore(&uci->lock, flags);
+		ret = -EBUSY;
+		goto free;
+	}
+	uci->ring = ring;
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	ret = remap_vmalloc_range(vma, ring->mem, 0);
+	if (ret) {
+		/* close() is not called on a failed mmap() */
+		uci_layer_ring_release(uci, owner);
+		kref_put(&ring->ref, uci_ring_free);
+		return ret;
+	}
+
+	vma->vm_ops = &uci_ring_vm_ops;
+	vma->vm_private_data = ring;
+	return 0;
+
+free:
+	vfree(ring->mem);
+	kfree(ring->pkts);
+	kfree(ring);
+	return ret;
+}
+
+void uci_layer_ring_release(struct uci_layer *uci, const void *owner)
+{
+	struct uci_ring *ring;
+	unsigned long flags;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	ring = uci->ring;
+	if (ring && owner && ring->owner != owner)
+		ring = NULL;
+	if (ring)
+		uci->ring = NULL;
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	if (ring)
+		kref_put(&ring->ref, uci_ring_free);
+}
+
 struct uci_packet *uci_layer_read(struct uci_layer *uci, size_t max_size,
-				  bool non_blocking)
+				  bool non_blocking, bool take_lost)
 {
 	struct uci_packet *p;
+	unsigned long flags;
 	int ret;
 
 	if (!non_blocking) {
@@ -218,16 +678,56 @@ struct uci_packet *uci_layer_read(struct uci_layer *uci, size_t max_size,
 			return ERR_PTR(ret);
 	}
 
-	mutex_lock(&uci->lock);
+	spin_lock_irqsave(&uci->lock, flags);
 	p = list_first_entry_or_null(&uci->rx_list, struct uci_packet, list);
 	if (p) {
 		if (p->length > max_size)
 			p = ERR_PTR(-EMSGSIZE);
-		else
+		else {
 			list_del(&p->list);
+			uci->rx_packets--;
+			uci->rx_bytes -= p->length;
+			p->lost = uci->rx_lost;
+			if (take_lost)
+				uci->rx_lost = false;
+		}
 	} else
 		p = ERR_PTR(-EAGAIN);
 
-	mutex_unlock(&uci->lock);
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	if (!IS_ERR(p))
+		uci_rx_update_throttle(uci);
 	return p;
 }
+
+int uci_layer_set_budget(struct uci_layer *uci,
+			 const struct qm35_rx_budget *budget)
+{
+	unsigned long flags;
+
+	if (budget->policy > QM35_RX_POLICY_BACKPRESSURE)
+		return -EINVAL;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	uci->budget = *budget;
+	spin_unlock_irqrestore(&uci->lock, flags);
+
+	/* the packets already queued are kept, they count in the budget */
+	uci_rx_update_throttle(uci);
+	return 0;
+}
+
+void uci_layer_get_stats(struct uci_layer *uci, struct qm35_rx_stats *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&uci->lock, flags);
+	memcpy(stats->dropped, uci->rx_dropped, sizeof(stats->dropped));
+	stats->queued_packets = uci->rx_packets;
+	stats->queued_bytes = uci->rx_bytes;
+	stats->throttled = uci->rx_throttled;
+	stats->lost = uci->rx_lost;
+	uci->rx_lost = false;
+	spin_unlock_irqrestore(&uci->lock, flags);
+}
@@ -30,43 +30,128 @@
 #define __HSSPI_UCI_H__
 
 #include <linux/completion.h>
+#include <linux/kref.h>
 #include <linux/list.h>
-#include <linux/mutex.h>
+#include <linux/mm_types.h>
+#include <linux/refcount.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/wait.h>
 
 #include "hsspi.h"
+#include "uci_ioctls.h"
+
+struct qm35_rx_ring;
+struct uci_ring;
+
+/* asynchronous writes in flight per file */
+#define UCI_TX_BUDGET 8
+
+#define UCI_PACKET_HEADER_SIZE (4)
+
+/**
+ * struct uci_tx_budget - asynchronous writes of a file
+ * @inflight: packets queued and not sent yet
+ * @error: first error of a sent packet not reported yet
+ * @deadline_missed: number of writes that missed their deadline
+ */
+struct uci_tx_budget {
+	atomic_t inflight;
+	atomic_t error;
+	atomic_t deadline_missed;
+};
 
 /**
  * struct uci_packet - UCI packet that implements a &struct hsspi_block.
  * @blk: &struct hsspi_block
- * @write_done: norify when the packet has been really send
+ * @write_done: norify when the packet has been really send, NULL if the
+ * write is asynchronous, taken with xchg() by uci_sent() or by a writer
+ * giving up
+ * @tx: &struct uci_tx_budget of an asynchronous write
  * @list: link with &struct uci_layer.rx_list
+ * @ring: &struct uci_ring the packet is received in, NULL if none
+ * @parent: packet holding the data of a split packet, NULL if none
+ * @lost: some packets were dropped before this one
+ * @ref: references to the data, one per split packet plus its own
+ * @timestamp: reception time
  * @status: status of the transfer
+ *
+ * A block holding several UCI packets is split in packets without
+ * block of their own, pointing in the block of @parent and pinning it
+ * until freed.
  */
 struct uci_packet {
 	struct hsspi_block blk;
 	struct completion *write_done;
+	struct uci_tx_budget *tx;
 	struct list_head list;
+	struct uci_ring *ring;
+	struct uci_packet *parent;
+	bool lost;
+	refcount_t ref;
+	ktime_t timestamp;
 	u8 *data;
 	int length;
 	int status;
 };
 
+/**
+ * struct uci_ring - RX ring shared with userspace
+ * @ref: released when unmapped, detached and with no packet in reception
+ * @mem: vmalloc_user() memory, a &struct qm35_rx_ring page then the slots
+ * @hdr: the &struct qm35_rx_ring at the start of @mem
+ * @pkts: descriptors of the slots
+ * @count: number of slots, a power of 2
+ * @next: next slot to hand out to the HSSPI
+ * @owner: file the ring is attached to
+ */
+struct uci_ring {
+	struct kref ref;
+	void *mem;
+	struct qm35_rx_ring *hdr;
+	struct uci_packet *pkts;
+	u32 count;
+	u32 next;
+	const void *owner;
+};
+
+/**
+ * uci_packet_cache_init() - create the kmem_cache of the UCI packets
+ *
+ * Return: 0 or -ENOMEM on error
+ */
+int uci_packet_cache_init(void);
+
+/**
+ * uci_packet_cache_exit() - destroy the kmem_cache of the UCI packets
+ */
+void uci_packet_cache_exit(void);
+
 /**
  * uci_packet_alloc() - Allocate an UCI packet
  * @length: length of the UCI packet
+ * @gfp: allocation flags
  *
  * Allocate an UCI packet that can be used by the HSSPI driver in
  * order to send or receive an UCI packet.
  *
  * Return: a newly allocated &struct uci_packet or NULL
  */
-struct uci_packet *uci_packet_alloc(u16 length);
+struct uci_packet *uci_packet_alloc(u16 length, gfp_t gfp);
+
+/**
+ * uci_packet_size() - Size of an UCI packet
+ * @header: the UCI_PACKET_HEADER_SIZE bytes of its header
+ *
+ * Return: the size of the packet, header included.
+ */
+size_t uci_packet_size(const u8 *header);
 
 /**
  * uci_packet_free() - Free an UCI packet
  * @p: pointer to the &struct uci_packet to free
  *
+ * The data is freed with the last packet referencing it.
  */
 void uci_packet_free(struct uci_packet *p);
 
@@ -74,13 +159,33 @@ void uci_packet_free(struct uci_packet *p);
  * struct uci_layer - Implement an HSSPI Layer
  * @hlayer: &struct hsspi_layer
  * @rx_list: list of received UCI packets
- * @lock: protect the &struct uci_layer.rx_list
- * @wq: notify when the &struct uci_layer.rx_list is not empty
+ * @ring: RX ring shared with userspace, NULL if none
+ * @budget: limits of @rx_list, QM35_RX_POLICY_* applied beyond
+ * @rx_packets: number of packets in @rx_list
+ * @rx_bytes: number of bytes in @rx_list
+ * @rx_dropped: packets dropped, per UCI message type
+ * @rx_lost: some packets were dropped since it was last reported, by a
+ * batch read or the RX statistics
+ * @rx_throttled: the HSSPI reads are stopped by the backpressure, as
+ * last applied by uci_rx_update_throttle()
+ * @rx_throttle_busy: uci_rx_update_throttle() is applying @rx_throttled
+ * @rx_throttle_recheck: the budget changed meanwhile, check it again
+ * @lock: protect the &struct uci_layer.rx_list, its accounting and @ring
+ * @wq: notify when the &struct uci_layer.rx_list or @ring is not empty
  */
 struct uci_layer {
 	struct hsspi_layer hlayer;
 	struct list_head rx_list;
-	struct mutex lock;
+	struct uci_ring *ring;
+	struct qm35_rx_budget budget;
+	unsigned int rx_packets;
+	unsigned int rx_bytes;
+	u64 rx_dropped[8];
+	bool rx_lost;
+	bool rx_throttled;
+	bool rx_throttle_busy;
+	bool rx_throttle_recheck;
+	spinlock_t lock;
 	wait_queue_head_t wq;
 };
 
@@ -96,6 +201,13 @@ int uci_layer_init(struct uci_layer *uci);
  */
 void uci_layer_deinit(struct uci_layer *uci);
 
+/**
+ * uci_layer_tx_drain() - wait for the asynchronous writes of a file
+ * @uci: pointer to &struct uci_layer
+ * @tx: the &struct uci_tx_budget of the file
+ */
+void uci_layer_tx_drain(struct uci_layer *uci, struct uci_tx_budget *tx);
+
 /**
  * uci_layer_has_data_availal() - checks if the layer has some rx packets
  * @uci: pointer to &struct uci_layer
@@ -106,11 +218,65 @@ void uci_layer_deinit(struct uci_layer *uci);
  */
 bool uci_layer_has_data_available(struct uci_layer *uci);
 
+/**
+ * uci_layer_ring_available() - checks if the RX ring has some packets
+ * @uci: pointer to &struct uci_layer
+ *
+ * Return: true if the RX ring holds some packets not consumed yet.
+ */
+bool uci_layer_ring_available(struct uci_layer *uci);
+
+/**
+ * uci_layer_mmap() - create the RX ring shared with userspace
+ * @uci: pointer to &struct uci_layer
+ * @vma: the &struct vm_area_struct to map it in
+ * @owner: file owning the ring
+ *
+ * The ring is sized after @vma, its first page holds the
+ * &struct qm35_rx_ring. Received packets go to the ring until
+ * uci_layer_ring_release() is called by @owner.
+ *
+ * Return: 0 if no error, -EBUSY if a ring already exists or -errno.
+ */
+int uci_layer_mmap(struct uci_layer *uci, struct vm_area_struct *vma,
+		   const void *owner);
+
+/**
+ * uci_layer_ring_release() - detach the RX ring
+ * @uci: pointer to &struct uci_layer
+ * @owner: file owning the ring
+ *
+ * Nothing is done if @owner does not own the ring. The memory is freed
+ * once unmapped.
+ */
+void uci_layer_ring_release(struct uci_layer *uci, const void *owner);
+
+/**
+ * uci_layer_set_budget() - limit the packets waiting to be read
+ * @uci: pointer to &struct uci_layer
+ * @budget: the &struct qm35_rx_budget to apply
+ *
+ * Return: 0 if no error or -EINVAL.
+ */
+int uci_layer_set_budget(struct uci_layer *uci,
+			 const struct qm35_rx_budget *budget);
+
+/**
+ * uci_layer_get_stats() - get the RX statistics
+ * @uci: pointer to &struct uci_layer
+ * @stats: filled with the statistics
+ *
+ * Consumes &struct uci_layer.rx_lost, reported in @stats.
+ */
+void uci_layer_get_stats(struct uci_layer *uci, struct qm35_rx_stats *stats);
+
 /**
  * uci_layer_read() - get a packet from the rx_list
  * @uci: pointer to &struct uci_layer
  * @max_size: maximum size possible for the UCI packet
  * @non_blocking: true if non blocking, false otherwise
+ * @take_lost: the caller reports &struct uci_packet.lost to userspace,
+ * which consumes &struct uci_layer.rx_lost
  *
  * This function returns an UCI packet if available in the
  * &struct uci_layer.rx_list. The max_size argument logic is due to the way
@@ -124,6 +290,6 @@ bool uci_layer_has_data_available(struct uci_layer *uci);
  *         -EAGAIN if there is no available UCI packet (in non blocking mode)
  */
 struct uci_packet *uci_layer_read(struct uci_layer *uci, size_t max_size,
-				  bool non_blocking);
+				  bool non_blocking, bool take_lost);
 
 #endif // __HSSPI_UCI_H__
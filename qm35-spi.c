@@ -42,6 +42,7 @@
 #include <linux/regulator/consumer.h>
 #ifdef CONFIG_QM35_DEBOUNCE_TIME_US
 #include <linux/ktime.h>
+#include <linux/workqueue.h>
 #endif
 
 #include <qmrom.h>
@@ -65,6 +66,9 @@
 
 static int qm_firmware_load(struct qm35_ctx *qm35_hdl);
 static void qm35_regulators_set(struct qm35_ctx *qm35_hdl, bool on);
+static int qm35_fw_upload_sync(struct qm35_ctx *qm35_hdl);
+static int qm35_power_sync(struct qm35_ctx *qm35_hdl, bool on);
+static int qm35_ctrl_async(struct qm35_ctx *qm35_hdl, unsigned int op);
 
 static const struct file_operations uci_fops;
 
@@ -99,6 +103,46 @@ module_param(wake_on_ssirq, bool, 0644);
 MODULE_PARM_DESC(wake_on_ssirq,
 		 "Allow QM35 to wakeup the platform using ss_irq");
 
+static uint full_duplex = HSSPI_DUPLEX_AUTO;
+module_param(full_duplex, uint, 0444);
+MODULE_PARM_DESC(full_duplex,
+		 "Read the QM35 output during writes: 0 off, 1 if supported (default), 2 forced");
+
+static bool async_engine;
+module_param(async_engine, bool, 0444);
+MODULE_PARM_DESC(async_engine,
+		 "Drive the HSSPI from spi_async() completions instead of a thread");
+
+static uint ss_ready_spin_us = HSSPI_SS_READY_SPIN_US;
+module_param(ss_ready_spin_us, uint, 0444);
+MODULE_PARM_DESC(ss_ready_spin_us,
+		 "Max time spent polling ss_ready before sleeping, 0 to never poll");
+
+static bool spi_calibrate;
+module_param(spi_calibrate, bool, 0444);
+MODULE_PARM_DESC(spi_calibrate,
+		 "Calibrate the default SPI clocks at probe (needs the HSSPI test firmware)");
+
+static uint flight_recorder_len = HSSPI_REC_LEN;
+module_param(flight_recorder_len, uint, 0444);
+MODULE_PARM_DESC(flight_recorder_len,
+		 "Number of STC transactions recorded for debugging, 0 to disable");
+
+static int hsspi_rt_prio;
+module_param(hsspi_rt_prio, int, 0444);
+MODULE_PARM_DESC(hsspi_rt_prio,
+		 "SCHED_FIFO priority of the HSSPI thread, 0 for SCHED_NORMAL");
+
+static char *hsspi_cpus;
+module_param(hsspi_cpus, charp, 0444);
+MODULE_PARM_DESC(hsspi_cpus,
+		 "CPU list for the HSSPI thread and the QM35 IRQs (e.g. 2-3)");
+
+static bool contiguous;
+module_param(contiguous, bool, 0444);
+MODULE_PARM_DESC(contiguous,
+		 "Send the STC header and the payload in a single transfer");
+
 int trace_spi_xfers;
 module_param(trace_spi_xfers, int, 0444);
 MODULE_PARM_DESC(trace_spi_xfers, "Trace all the SPI transfers");
@@ -118,6 +162,22 @@ MODULE_PARM_DESC(log_qm_traces, "Logs the QM35 traces in the kernel messages");
 static uint8_t qm_soc_id[ROM_SOC_ID_LEN];
 static uint16_t qm_dev_id;
 
+/**
+ * struct uci_client - uci device file context
+ * @qm35_hdl: &struct qm35_ctx
+ * @tx_deadline_us: deadline given to each written packet, 0 if none
+ * @tx: asynchronous writes and TX statistics
+ * @event_seq: sequence number of the last event read
+ * @read_mode: QM35_READ_MODE_* of uci_read()
+ */
+struct uci_client {
+	struct qm35_ctx *qm35_hdl;
+	unsigned int tx_deadline_us;
+	struct uci_tx_budget tx;
+	unsigned int event_seq;
+	unsigned int read_mode;
+};
+
 /*
  * uci_open() : open operation for uci device
  *
@@ -127,8 +187,24 @@ static int uci_open(struct inode *inode, struct file *file)
 	struct miscdevice *uci_dev = file->private_data;
 	struct qm35_ctx *qm35_hdl =
 		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client;
+	int ret;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	client->qm35_hdl = qm35_hdl;
+	client->event_seq = READ_ONCE(qm35_hdl->ctrl_event.seq);
 
-	return hsspi_register(&qm35_hdl->hsspi, &qm35_hdl->uci_layer.hlayer);
+	ret = hsspi_register(&qm35_hdl->hsspi, &qm35_hdl->uci_layer.hlayer);
+	if (ret) {
+		kfree(client);
+		return ret;
+	}
+
+	file->private_data = client;
+	return 0;
 }
 
 /*
@@ -138,9 +214,8 @@ static int uci_open(struct inode *inode, struct file *file)
 static long uci_ioctl(struct file *filp, unsigned int cmd, unsigned long args)
 {
 	void __user *argp = (void __user *)args;
-	struct miscdevice *uci_dev = filp->private_data;
-	struct qm35_ctx *qm35_hdl =
-		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
 	int ret;
 
 	switch (cmd) {
@@ -151,14 +226,7 @@ static long uci_ioctl(struct file *filp, unsigned int cmd, unsigned long args)
 			       0;
 	}
 	case QM35_CTRL_RESET: {
-		qm35_hsspi_stop(qm35_hdl);
-
-		ret = qm35_reset(qm35_hdl, QM_RESET_LOW_MS, true);
-
-		msleep(QM_BOOT_MS);
-
-		qm35_hsspi_start(qm35_hdl);
-
+		ret = qm35_reset_sync(qm35_hdl);
 		if (ret)
 			return ret;
 
@@ -168,14 +236,7 @@ static long uci_ioctl(struct file *filp, unsigned int cmd, unsigned long args)
 			       0;
 	}
 	case QM35_CTRL_FW_UPLOAD: {
-		qm35_hsspi_stop(qm35_hdl);
-
-		ret = qm_firmware_load(qm35_hdl);
-
-		msleep(QM_BOOT_MS);
-
-		qm35_hsspi_start(qm35_hdl);
-
+		ret = qm35_fw_upload_sync(qm35_hdl);
 		if (ret)
 			return ret;
 
@@ -191,26 +252,85 @@ static long uci_ioctl(struct file *filp, unsigned int cmd, unsigned long args)
 		if (ret)
 			return ret;
 
-		qm35_hsspi_stop(qm35_hdl);
+		return qm35_power_sync(qm35_hdl, on);
+	}
+	case QM35_CTRL_RESET_ASYNC:
+		return qm35_ctrl_async(qm35_hdl, QM35_CTRL_OP_RESET);
+	case QM35_CTRL_FW_UPLOAD_ASYNC:
+		return qm35_ctrl_async(qm35_hdl, QM35_CTRL_OP_FW_UPLOAD);
+	case QM35_CTRL_POWER_ASYNC: {
+		unsigned int on;
+
+		ret = get_user(on, (unsigned int __user *)argp);
+		if (ret)
+			return ret;
 
-		if (REGULATORS_ENABLED(qm35_hdl))
-			qm35_regulators_set(qm35_hdl, on);
+		return qm35_ctrl_async(qm35_hdl, on ? QM35_CTRL_OP_POWER_ON :
+						      QM35_CTRL_OP_POWER_OFF);
+	}
+	case QM35_CTRL_GET_TX_ERROR:
+		return put_user(atomic_xchg(&client->tx.error, 0),
+				(int __user *)argp);
+	case QM35_CTRL_SET_READ_MODE: {
+		unsigned int mode;
 
-		/*
-		 * Always reset QM as regulators could be shared with
-		 * other devices and power may not be controlled as
-		 * expected
-		 */
-		qm35_reset(qm35_hdl, QM_RESET_LOW_MS, on);
-		msleep(QM_BOOT_MS);
+		ret = get_user(mode, (unsigned int __user *)argp);
+		if (ret)
+			return ret;
+
+		if (mode > QM35_READ_MODE_BATCH)
+			return -EINVAL;
+
+		WRITE_ONCE(client->read_mode, mode);
+		return 0;
+	}
+	case QM35_CTRL_SET_RX_BUDGET: {
+		struct qm35_rx_budget budget;
+
+		if (copy_from_user(&budget, argp, sizeof(budget)))
+			return -EFAULT;
+
+		return uci_layer_set_budget(&qm35_hdl->uci_layer, &budget);
+	}
+	case QM35_CTRL_GET_RX_STATS: {
+		struct qm35_rx_stats stats = {};
+
+		uci_layer_get_stats(&qm35_hdl->uci_layer, &stats);
+		return copy_to_user(argp, &stats, sizeof(stats)) ? -EFAULT : 0;
+	}
+	case QM35_CTRL_GET_EVENT: {
+		struct qm35_ctrl_event event;
+		unsigned long flags;
+
+		spin_lock_irqsave(&qm35_hdl->lock, flags);
+		event = qm35_hdl->ctrl_event;
+		event.state = qm35_hdl->state;
+		spin_unlock_irqrestore(&qm35_hdl->lock, flags);
 
-		/* If reset or power on */
-		if (!REGULATORS_ENABLED(qm35_hdl) ||
-		    (REGULATORS_ENABLED(qm35_hdl) && on))
-			qm35_hsspi_start(qm35_hdl);
+		if (copy_to_user(argp, &event, sizeof(event)))
+			return -EFAULT;
 
+		WRITE_ONCE(client->event_seq, event.seq);
 		return 0;
 	}
+	case QM35_CTRL_SET_TX_DEADLINE: {
+		unsigned int deadline_us;
+
+		ret = get_user(deadline_us, (unsigned int __user *)argp);
+		if (ret)
+			return ret;
+
+		WRITE_ONCE(client->tx_deadline_us, deadline_us);
+		return 0;
+	}
+	case QM35_CTRL_GET_TX_STATS: {
+		struct qm35_tx_stats stats = {
+			.deadline_missed =
+				atomic_read(&client->tx.deadline_missed),
+		};
+
+		return copy_to_user(argp, &stats, sizeof(stats)) ? -EFAULT : 0;
+	}
 	default:
 		dev_err(&qm35_hdl->spi->dev, "unknown ioctl %x to %s device\n",
 			cmd, qm35_hdl->uci_dev.name);
@@ -224,31 +344,96 @@ static long uci_ioctl(struct file *filp, unsigned int cmd, unsigned long args)
  */
 static int uci_release(struct inode *inode, struct file *filp)
 {
-	struct miscdevice *uci_dev = filp->private_data;
-	struct qm35_ctx *qm35_hdl =
-		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
 
+	uci_layer_ring_release(&qm35_hdl->uci_layer, filp);
 	hsspi_unregister(&qm35_hdl->hsspi, &qm35_hdl->uci_layer.hlayer);
+	uci_layer_tx_drain(&qm35_hdl->uci_layer, &client->tx);
+
+	kfree(client);
 	return 0;
 }
 
-static ssize_t uci_read(struct file *filp, char __user *buf, size_t len,
-			loff_t *off)
+/*
+ * uci_mmap() - map the RX ring shared with userspace, see
+ * &struct qm35_rx_ring.
+ *
+ */
+static int uci_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	struct miscdevice *uci_dev = filp->private_data;
-	struct qm35_ctx *qm35_hdl =
-		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
+
+	return uci_layer_mmap(&qm35_hdl->uci_layer, vma, filp);
+}
+
+/*
+ * uci_read_batch() - read as many whole UCI packets as fit in @to, each
+ * preceded by a &struct qm35_read_hdr. Only the first one is waited for.
+ *
+ */
+static ssize_t uci_read_batch(struct uci_layer *uci, struct iov_iter *to,
+			      bool non_blocking)
+{
+	struct qm35_read_hdr hdr = {};
 	struct uci_packet *p;
-	int ret;
+	ssize_t ret = 0;
+
+	while (iov_iter_count(to) > sizeof(hdr)) {
+		p = uci_layer_read(uci, iov_iter_count(to) - sizeof(hdr),
+				   non_blocking || ret, true);
+		if (IS_ERR(p)) {
+			/* report the error only if nothing was read */
+			if (!ret)
+				ret = PTR_ERR(p);
+			break;
+		}
+
+		hdr.length = p->length;
+		hdr.flags = p->lost ? QM35_READ_FLAG_LOST : 0;
+		hdr.timestamp_ns = ktime_to_ns(p->timestamp);
+		if (copy_to_iter(&hdr, sizeof(hdr), to) != sizeof(hdr) ||
+		    copy_to_iter(p->data, p->length, to) != p->length) {
+			uci_packet_free(p);
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+
+		ret += sizeof(hdr) + p->length;
+		uci_packet_free(p);
+	}
+
+	return ret ? ret : -EMSGSIZE;
+}
+
+/*
+ * uci_read_iter() - read operation for uci device, also used by read().
+ *
+ */
+static ssize_t uci_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
+	bool non_blocking = (filp->f_flags & O_NONBLOCK) ||
+			    (iocb->ki_flags & IOCB_NOWAIT);
+	struct uci_packet *p;
+	ssize_t ret;
+
+	if (READ_ONCE(client->read_mode) == QM35_READ_MODE_BATCH)
+		return uci_read_batch(&qm35_hdl->uci_layer, to, non_blocking);
 
-	p = uci_layer_read(&qm35_hdl->uci_layer, len,
-			   filp->f_flags & O_NONBLOCK);
+	/* no room for the lost flag, QM35_CTRL_GET_RX_STATS reports it */
+	p = uci_layer_read(&qm35_hdl->uci_layer, iov_iter_count(to),
+			   non_blocking, false);
 	if (IS_ERR(p))
 		return PTR_ERR(p);
 
-	ret = copy_to_user(buf, p->data, p->length);
-	if (!ret)
-		ret = p->length;
+	ret = p->length;
+	if (copy_to_iter(p->data, p->length, to) != p->length)
+		ret = -EFAULT;
 
 	uci_packet_free(p);
 	return ret;
@@ -257,18 +442,38 @@ static ssize_t uci_read(struct file *filp, char __user *buf, size_t len,
 static ssize_t uci_write(struct file *filp, const char __user *buf, size_t len,
 			 loff_t *off)
 {
-	struct miscdevice *uci_dev = filp->private_data;
-	struct qm35_ctx *qm35_hdl =
-		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
+	unsigned int deadline_us = READ_ONCE(client->tx_deadline_us);
+	/* O_NONBLOCK writes are asynchronous and use the TX budget */
+	bool async = filp->f_flags & O_NONBLOCK;
+	DECLARE_COMPLETION_ONSTACK(sync_done);
+	ktime_t deadline = 0;
 	struct uci_packet *p;
-	DECLARE_COMPLETION_ONSTACK(comp);
 	int ret;
 
-	p = uci_packet_alloc(len);
-	if (!p)
-		return -ENOMEM;
+	/* the errors of the asynchronous writes are only reported by
+	 * EPOLLERR and QM35_CTRL_GET_TX_ERROR, never instead of this one
+	 */
+	if (async &&
+	    atomic_inc_return(&client->tx.inflight) > UCI_TX_BUDGET) {
+		atomic_dec(&client->tx.inflight);
+		return -EAGAIN;
+	}
 
-	p->write_done = &comp;
+	if (deadline_us)
+		deadline = ktime_add_us(ktime_get(), deadline_us);
+
+	p = uci_packet_alloc(len, GFP_KERNEL);
+	if (!p) {
+		ret = -ENOMEM;
+		goto unbudget;
+	}
+
+	/* asynchronous writes are freed by uci_sent() */
+	p->write_done = async ? NULL : &sync_done;
+	p->tx = &client->tx;
+	p->blk.deadline = deadline;
 
 	if (copy_from_user(p->data, buf, len)) {
 		ret = -EFAULT;
@@ -280,25 +485,203 @@ static ssize_t uci_write(struct file *filp, const char __user *buf, size_t len,
 	if (ret)
 		goto free;
 
-	wait_for_completion(&comp);
+	if (async)
+		return len;
+
+	wait_for_completion(&sync_done);
+
+	if (p->status == -ETIME)
+		atomic_inc(&client->tx.deadline_missed);
 
 	ret = p->status ? p->status : len;
 free:
 	uci_packet_free(p);
+unbudget:
+	if (async)
+		atomic_dec(&client->tx.inflight);
 	return ret;
 }
 
+/*
+ * uci_write_abandon() - hand the packets still in flight over to uci_sent()
+ * @client: the writer
+ * @blks: packets of the write, the abandoned ones are set to NULL
+ * @n: number of packets
+ *
+ * Used when a blocking writer is killed: the packets it no longer waits
+ * for are accounted and freed like asynchronous writes.
+ */
+static void uci_write_abandon(struct uci_client *client,
+			      struct hsspi_block **blks, int n)
+{
+	struct uci_packet *p;
+	struct completion *done;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		p = container_of(blks[i], struct uci_packet, blk);
+		atomic_inc(&client->tx.inflight);
+		done = xchg(&p->write_done, NULL);
+		if (done) {
+			blks[i] = NULL;
+			continue;
+		}
+		/* uci_sent() got it first and is about to complete it */
+		atomic_dec(&client->tx.inflight);
+	}
+}
+
+/*
+ * uci_write_iter() - write operation for uci device taking whole UCI
+ * packets back to back, used by writev() and io_uring. Up to
+ * QM35_TX_MAX_PACKETS packets are queued at once and in order, more is
+ * rejected. IOCB_NOWAIT writes are asynchronous and do not sleep in
+ * allocations.
+ *
+ */
+static ssize_t uci_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *filp = iocb->ki_filp;
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_hdl = client->qm35_hdl;
+	unsigned int deadline_us = READ_ONCE(client->tx_deadline_us);
+	bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+	bool non_blocking = (filp->f_flags & O_NONBLOCK) || nowait;
+	gfp_t gfp = nowait ? GFP_NOWAIT : GFP_KERNEL;
+	struct completion done[QM35_TX_MAX_PACKETS];
+	struct hsspi_block *blks[QM35_TX_MAX_PACKETS];
+	u8 header[UCI_PACKET_HEADER_SIZE];
+	ktime_t deadline = 0;
+	struct uci_packet *p;
+	ssize_t written = 0;
+	int ret, i, n = 0;
+	size_t size;
+
+	/* both arrays live on the stack */
+	BUILD_BUG_ON(sizeof(done) + sizeof(blks) > 512);
+	/* an asynchronous writev() must fit in an idle budget */
+	BUILD_BUG_ON(QM35_TX_MAX_PACKETS > UCI_TX_BUDGET);
+
+	/* as uci_write(), earlier asynchronous errors are not returned */
+	if (deadline_us)
+		deadline = ktime_add_us(ktime_get(), deadline_us);
+
+	while (iov_iter_count(from)) {
+		if (n == QM35_TX_MAX_PACKETS) {
+			ret = -EINVAL;
+			goto free;
+		}
+
+		if (iov_iter_count(from) < sizeof(header)) {
+			ret = -EINVAL;
+			goto free;
+		}
+
+		if (!copy_from_iter_full(header, sizeof(header), from)) {
+			ret = -EFAULT;
+			goto free;
+		}
+
+		size = uci_packet_size(header);
+		if (size > U16_MAX ||
+		    size - sizeof(header) > iov_iter_count(from)) {
+			ret = -EINVAL;
+			goto free;
+		}
+
+		p = uci_packet_alloc(size, gfp);
+		if (!p) {
+			ret = nowait ? -EAGAIN : -ENOMEM;
+			goto free;
+		}
+		blks[n++] = &p->blk;
+
+		memcpy(p->data, header, sizeof(header));
+		if (!copy_from_iter_full(p->data + sizeof(header),
+					 size - sizeof(header), from)) {
+			ret = -EFAULT;
+			goto free;
+		}
+
+		/* asynchronous writes are freed by uci_sent() */
+		if (non_blocking) {
+			p->write_done = NULL;
+		} else {
+			init_completion(&done[n - 1]);
+			p->write_done = &done[n - 1];
+		}
+		p->tx = &client->tx;
+		p->blk.deadline = deadline;
+		written += size;
+	}
+
+	if (!n)
+		return -EINVAL;
+
+	if (non_blocking &&
+	    atomic_add_return(n, &client->tx.inflight) > UCI_TX_BUDGET) {
+		atomic_sub(n, &client->tx.inflight);
+		ret = -EAGAIN;
+		goto free;
+	}
+
+	ret = hsspi_send_batch(&qm35_hdl->hsspi, &qm35_hdl->uci_layer.hlayer,
+			       blks, n);
+	if (ret) {
+		if (non_blocking)
+			atomic_sub(n, &client->tx.inflight);
+		goto free;
+	}
+
+	if (non_blocking)
+		return written;
+
+	for (i = 0; i < n; i++) {
+		ret = wait_for_completion_killable(&done[i]);
+		if (ret) {
+			uci_write_abandon(client, blks + i, n - i);
+			/* the packets left are being completed */
+			for (; i < n; i++)
+				if (blks[i])
+					wait_for_completion(&done[i]);
+			goto free;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		p = container_of(blks[i], struct uci_packet, blk);
+		if (p->status == -ETIME)
+			atomic_inc(&client->tx.deadline_missed);
+		if (!ret)
+			ret = p->status;
+	}
+
+free:
+	for (i = 0; i < n; i++)
+		if (blks[i])
+			uci_packet_free(container_of(blks[i],
+						     struct uci_packet, blk));
+	return ret ? ret : written;
+}
+
 static __poll_t uci_poll(struct file *filp, struct poll_table_struct *wait)
 {
-	struct miscdevice *uci_dev = filp->private_data;
-	struct qm35_ctx *qm35_ctx =
-		container_of(uci_dev, struct qm35_ctx, uci_dev);
+	struct uci_client *client = filp->private_data;
+	struct qm35_ctx *qm35_ctx = client->qm35_hdl;
 	__poll_t mask = 0;
 
 	poll_wait(filp, &qm35_ctx->uci_layer.wq, wait);
+	poll_wait(filp, &qm35_ctx->ctrl_wq, wait);
 
-	if (uci_layer_has_data_available(&qm35_ctx->uci_layer))
+	if (uci_layer_has_data_available(&qm35_ctx->uci_layer) ||
+	    uci_layer_ring_available(&qm35_ctx->uci_layer))
 		mask |= EPOLLIN;
+	if (READ_ONCE(qm35_ctx->ctrl_event.seq) != READ_ONCE(client->event_seq))
+		mask |= EPOLLPRI;
+	if (atomic_read(&client->tx.inflight) < UCI_TX_BUDGET)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	if (atomic_read(&client->tx.error))
+		mask |= EPOLLERR;
 
 	return mask;
 }
@@ -308,18 +691,18 @@ static const struct file_operations uci_fops = {
 	.open = uci_open,
 	.release = uci_release,
 	.unlocked_ioctl = uci_ioctl,
-	.read = uci_read,
+	.read_iter = uci_read_iter,
 	.write = uci_write,
+	.write_iter = uci_write_iter,
 	.poll = uci_poll,
+	.mmap = uci_mmap,
 };
 
 static irqreturn_t qm35_irq_handler(int irq, void *qm35_ctx)
 {
 	struct qm35_ctx *qm35_hdl = qm35_ctx;
 
-	spin_lock(&qm35_hdl->lock);
-	qm35_hdl->state = QM35_CTRL_STATE_READY;
-	spin_unlock(&qm35_hdl->lock);
+	qm35_set_state(qm35_hdl, QM35_CTRL_STATE_READY);
 
 	disable_irq_nosync(irq);
 
@@ -360,9 +743,72 @@ static irqreturn_t qm35_ss_rdy_handler(int irq, void *data)
 	hsspi_clear_spi_slave_busy(&qm35_hdl->hsspi);
 	hsspi_set_spi_slave_ready(&qm35_hdl->hsspi);
 
+	/* The ROM code only toggles ss_ready, the firmware holds it high:
+	 * only a hint, qm35_boot_wait() checks that it stays high
+	 */
+	if (READ_ONCE(qm35_hdl->booting) &&
+	    gpiod_get_value(qm35_hdl->gpio_ss_rdy))
+		complete(&qm35_hdl->boot_done);
+
 	return IRQ_HANDLED;
 }
 
+int qm35_boot_wait(struct qm35_ctx *qm35_hdl, unsigned int timeout_ms,
+		   bool irq_disabled)
+{
+	struct qm35_boot_stats *stats = &qm35_hdl->boot_stats;
+	int irq = gpiod_to_irq(qm35_hdl->gpio_ss_rdy);
+	unsigned long deadline, left;
+	bool booted = false;
+	ktime_t start;
+	u32 us;
+
+	lockdep_assert_held(&qm35_hdl->ctrl_lock);
+
+	reinit_completion(&qm35_hdl->boot_done);
+	start = ktime_get();
+	deadline = jiffies + msecs_to_jiffies(timeout_ms);
+	WRITE_ONCE(qm35_hdl->booting, true);
+	if (irq_disabled && irq >= 0)
+		enable_irq(irq);
+
+	while (!booted && time_before(jiffies, deadline)) {
+		left = wait_for_completion_timeout(&qm35_hdl->boot_done,
+						   deadline - jiffies);
+		if (!left)
+			break;
+		/* A ss_ready pulse from the ROM code is not a boot, the
+		 * firmware must still hold it high a little later
+		 */
+		usleep_range(QM_BOOT_STABLE_US, QM_BOOT_STABLE_US * 2);
+		reinit_completion(&qm35_hdl->boot_done);
+		booted = gpiod_get_value_cansleep(qm35_hdl->gpio_ss_rdy);
+	}
+
+	WRITE_ONCE(qm35_hdl->booting, false);
+	if (irq_disabled && irq >= 0)
+		disable_irq(irq);
+
+	if (!booted) {
+		stats->timeouts++;
+		dev_dbg(&qm35_hdl->spi->dev, "boot not detected in %u ms\n",
+			timeout_ms);
+		return -ETIMEDOUT;
+	}
+
+	us = ktime_us_delta(ktime_get(), start);
+	if (!stats->boots || us < stats->min_us)
+		stats->min_us = us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+	stats->last_us = us;
+	stats->total_us += us;
+	stats->boots++;
+	dev_dbg(&qm35_hdl->spi->dev, "booted in %u us\n", us);
+
+	return us;
+}
+
 static void qm35_wakeup(struct hsspi *hsspi)
 {
 	struct qm35_ctx *qm35_hdl = container_of(hsspi, struct qm35_ctx, hsspi);
@@ -381,6 +827,9 @@ static void qm35_reset_hook(struct hsspi *hsspi)
 
 	if (reset_on_error)
 		qm35_reset(qm35_hdl, QM_RESET_LOW_MS, true);
+	/* Called from the HSSPI thread, without ctrl_lock and maybe
+	 * without a reset: wait the whole delay, whatever ss_ready does
+	 */
 	usleep_range(QM_BEFORE_RESET_MS * 1000, QM_BEFORE_RESET_MS * 1000);
 }
 
@@ -448,14 +897,121 @@ int qm35_reset_sync(struct qm35_ctx *qm35_hdl)
 {
 	int ret;
 
+	mutex_lock(&qm35_hdl->ctrl_lock);
 	qm35_hsspi_stop(qm35_hdl);
 	ret = qm35_reset(qm35_hdl, QM_RESET_LOW_MS, true);
-	msleep(QM_BOOT_MS);
+	qm35_boot_wait(qm35_hdl, QM_BOOT_MS, true);
 	qm35_hsspi_start(qm35_hdl);
+	mutex_unlock(&qm35_hdl->ctrl_lock);
 
 	return ret;
 }
 
+static int qm35_fw_upload_sync(struct qm35_ctx *qm35_hdl)
+{
+	int ret;
+
+	mutex_lock(&qm35_hdl->ctrl_lock);
+	qm35_hsspi_stop(qm35_hdl);
+	ret = qm_firmware_load(qm35_hdl);
+	qm35_boot_wait(qm35_hdl, QM_BOOT_MS, true);
+	qm35_hsspi_start(qm35_hdl);
+	mutex_unlock(&qm35_hdl->ctrl_lock);
+
+	return ret;
+}
+
+static int qm35_power_sync(struct qm35_ctx *qm35_hdl, bool on)
+{
+	mutex_lock(&qm35_hdl->ctrl_lock);
+	qm35_hsspi_stop(qm35_hdl);
+
+	if (REGULATORS_ENABLED(qm35_hdl))
+		qm35_regulators_set(qm35_hdl, on);
+
+	/*
+	 * Always reset QM as regulators could be shared with
+	 * other devices and power may not be controlled as
+	 * expected
+	 */
+	qm35_reset(qm35_hdl, QM_RESET_LOW_MS, on);
+	if (on)
+		qm35_boot_wait(qm35_hdl, QM_BOOT_MS, true);
+
+	/* If reset or power on */
+	if (!REGULATORS_ENABLED(qm35_hdl) ||
+	    (REGULATORS_ENABLED(qm35_hdl) && on))
+		qm35_hsspi_start(qm35_hdl);
+	mutex_unlock(&qm35_hdl->ctrl_lock);
+
+	return 0;
+}
+
+static void qm35_ctrl_work(struct work_struct *work)
+{
+	struct qm35_ctx *qm35_hdl =
+		container_of(work, struct qm35_ctx, ctrl_work);
+	unsigned long flags;
+	int ret;
+
+	switch (qm35_hdl->ctrl_op) {
+	case QM35_CTRL_OP_RESET:
+		ret = qm35_reset_sync(qm35_hdl);
+		break;
+	case QM35_CTRL_OP_FW_UPLOAD:
+		ret = qm35_fw_upload_sync(qm35_hdl);
+		break;
+	case QM35_CTRL_OP_POWER_OFF:
+	case QM35_CTRL_OP_POWER_ON:
+		ret = qm35_power_sync(qm35_hdl,
+				      qm35_hdl->ctrl_op == QM35_CTRL_OP_POWER_ON);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	spin_lock_irqsave(&qm35_hdl->lock, flags);
+	qm35_hdl->ctrl_event.result = ret;
+	qm35_hdl->ctrl_event.seq++;
+	qm35_hdl->ctrl_busy = false;
+	spin_unlock_irqrestore(&qm35_hdl->lock, flags);
+
+	wake_up_interruptible(&qm35_hdl->ctrl_wq);
+}
+
+/**
+ * qm35_ctrl_async() - start an operation in the background
+ * @qm35_hdl: the &struct qm35_ctx
+ * @op: one of QM35_CTRL_OP_*
+ *
+ * Its start and its end are reported as events to the pollers.
+ *
+ * Return: 0 if started or -EBUSY if an operation is already running.
+ */
+static int qm35_ctrl_async(struct qm35_ctx *qm35_hdl, unsigned int op)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&qm35_hdl->lock, flags);
+	if (qm35_hdl->ctrl_busy) {
+		spin_unlock_irqrestore(&qm35_hdl->lock, flags);
+		return -EBUSY;
+	}
+	qm35_hdl->ctrl_busy = true;
+	qm35_hdl->ctrl_op = op;
+	qm35_hdl->ctrl_event.op = op;
+	qm35_hdl->ctrl_event.result = -EINPROGRESS;
+	qm35_hdl->ctrl_event.seq++;
+	spin_unlock_irqrestore(&qm35_hdl->lock, flags);
+
+	wake_up_interruptible(&qm35_hdl->ctrl_wq);
+
+	/* a firmware upload takes seconds */
+	queue_work(system_long_wq, &qm35_hdl->ctrl_work);
+	return 0;
+}
+
 static int qm_firmware_flashing(void *handle, struct qmrom_handle *h,
 				bool use_prod_fw)
 {
@@ -547,6 +1103,89 @@ int qm_get_soc_id(struct qm35_ctx *qm35_hdl, uint8_t *soc_id)
 	return 0;
 }
 
+int qm35_set_sched(struct qm35_ctx *qm35_hdl, int prio,
+		   const struct cpumask *cpus)
+{
+	int irqs[] = {
+		gpiod_to_irq(qm35_hdl->gpio_ss_rdy),
+		qm35_hdl->spi->irq,
+		qm35_hdl->gpio_exton ? gpiod_to_irq(qm35_hdl->gpio_exton) : -1,
+	};
+	cpumask_var_t prev;
+	int ret = 0;
+	int i;
+
+	if (!alloc_cpumask_var(&prev, GFP_KERNEL))
+		return -ENOMEM;
+
+	/* the IRQs always follow the thread */
+	cpumask_copy(prev, &qm35_hdl->hsspi.sched_cpus);
+
+	if (!cpus)
+		cpus = cpu_possible_mask;
+
+	for (i = 0; i < ARRAY_SIZE(irqs); i++) {
+		if (irqs[i] < 0)
+			continue;
+		ret = irq_set_affinity(irqs[i], cpus);
+		if (ret)
+			goto restore;
+	}
+
+	ret = hsspi_set_sched(&qm35_hdl->hsspi, prio, cpus);
+	if (!ret)
+		goto free;
+
+restore:
+	while (i--)
+		if (irqs[i] >= 0)
+			irq_set_affinity(irqs[i], prev);
+free:
+	free_cpumask_var(prev);
+	return ret;
+}
+
+/**
+ * qm35_sched_setup() - apply the HSSPI scheduling settings
+ *
+ * @qm35_ctx: the &struct qm35_ctx
+ *
+ * The `hsspi_rt_prio` and `hsspi_cpus` module parameters take
+ * precedence over the `qorvo,hsspi-rt-priority` and `qorvo,hsspi-cpus`
+ * DTS properties.
+ *
+ * Return: 0 if no error or -errno.
+ */
+static int qm35_sched_setup(struct qm35_ctx *qm35_ctx)
+{
+	struct device *dev = &qm35_ctx->spi->dev;
+	const char *cpulist = hsspi_cpus;
+	u32 prio = hsspi_rt_prio;
+	cpumask_var_t cpus;
+	int ret;
+
+	if (!prio)
+		device_property_read_u32(dev, "qorvo,hsspi-rt-priority", &prio);
+	if (!cpulist)
+		device_property_read_string(dev, "qorvo,hsspi-cpus", &cpulist);
+
+	if (!prio && !cpulist)
+		return 0;
+
+	if (!zalloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (cpulist && cpulist_parse(cpulist, cpus)) {
+		dev_err(dev, "invalid HSSPI CPU list '%s'\n", cpulist);
+		ret = -EINVAL;
+	} else {
+		ret = qm35_set_sched(qm35_ctx, prio, cpulist ? cpus : NULL);
+	}
+
+	free_cpumask_var(cpus);
+	return ret;
+}
+
 /**
  * hsspi_irqs_setup() - setup all irqs needed by HSSPI
  * @qm35_ctx: pointer to &struct qm35_ctx
@@ -761,6 +1400,10 @@ static int qm35_probe(struct spi_device *spi)
 	qm35_ctx->spi = spi;
 	qm35_ctx->log_qm_traces = log_qm_traces;
 	spin_lock_init(&qm35_ctx->lock);
+	init_completion(&qm35_ctx->boot_done);
+	mutex_init(&qm35_ctx->ctrl_lock);
+	init_waitqueue_head(&qm35_ctx->ctrl_wq);
+	INIT_WORK(&qm35_ctx->ctrl_work, qm35_ctrl_work);
 
 	spi_set_drvdata(spi, qm35_ctx);
 
@@ -793,6 +1436,14 @@ static int qm35_probe(struct spi_device *spi)
 	if (ret)
 		goto poweroff;
 
+	qm35_ctx->hsspi.full_duplex = full_duplex;
+	qm35_ctx->hsspi.contiguous = contiguous;
+	qm35_ctx->hsspi.ss_ready_spin_us = ss_ready_spin_us;
+
+	ret = hsspi_rec_init(&qm35_ctx->hsspi, flight_recorder_len);
+	if (ret)
+		goto hsspi_deinit;
+
 	ret = uci_layer_init(&qm35_ctx->uci_layer);
 	if (ret)
 		goto hsspi_deinit;
@@ -822,12 +1473,23 @@ static int qm35_probe(struct spi_device *spi)
 	if (ret)
 		goto coredump_layer_unregister;
 
-	msleep(QM_BOOT_MS);
-
 	ret = hsspi_irqs_setup(qm35_ctx);
 	if (ret)
 		goto log_layer_unregister;
 
+	/* Nothing boots while the regulators are off, ss_ready IRQ is
+	 * already enabled as it has just been requested
+	 */
+	if (!REGULATORS_ENABLED(qm35_ctx)) {
+		mutex_lock(&qm35_ctx->ctrl_lock);
+		qm35_boot_wait(qm35_ctx, QM_BOOT_MS, false);
+		mutex_unlock(&qm35_ctx->ctrl_lock);
+	}
+
+	ret = qm35_sched_setup(qm35_ctx);
+	if (ret)
+		dev_warn(&spi->dev, "HSSPI scheduling not applied (%d)\n", ret);
+
 	if (flash_on_probe) {
 		qm35_regulators_set(qm35_ctx, true);
 		ret = qm_firmware_load(qm35_ctx);
@@ -839,6 +1501,19 @@ static int qm35_probe(struct spi_device *spi)
 	hsspi_set_gpios(&qm35_ctx->hsspi, qm35_ctx->gpio_ss_rdy,
 			qm35_ctx->gpio_exton);
 
+	if (async_engine) {
+		/* qm35_wakeup() is also called from atomic context */
+		if (gpiod_cansleep(qm35_ctx->gpio_csn) ||
+		    gpiod_cansleep(qm35_ctx->gpio_wakeup))
+			ret = -EOPNOTSUPP;
+		else
+			ret = hsspi_set_async(&qm35_ctx->hsspi, true);
+		if (ret)
+			dev_warn(&spi->dev,
+				 "asynchronous engine not available (%d)\n",
+				 ret);
+	}
+
 	if (!NO_UWB_HAL) {
 		/* If regulators not available, QM is powered on */
 		if (!REGULATORS_ENABLED(qm35_ctx))
@@ -849,6 +1524,20 @@ static int qm35_probe(struct spi_device *spi)
 		hsspi_start(&qm35_ctx->hsspi);
 	}
 
+	if (spi_calibrate && READ_ONCE(qm35_ctx->hsspi.state) != HSSPI_RUNNING) {
+		dev_warn(&spi->dev,
+			 "SPI clock calibration skipped, HSSPI not started\n");
+	} else if (spi_calibrate) {
+		ret = hsspi_test_calibrate(&qm35_ctx->hsspi, 0,
+					   HSSPI_TEST_CALIB_MIN_HZ,
+					   spi->controller->max_speed_hz ?:
+						   spi->max_speed_hz,
+					   HSSPI_TEST_CALIB_STEP_HZ);
+		if (ret < 0)
+			dev_warn(&spi->dev, "SPI clock calibration failed (%d)\n",
+				 ret);
+	}
+
 	ret = misc_register(&qm35_ctx->uci_dev);
 	if (ret) {
 		dev_err(&spi->dev, "Failed to register uci device\n");
@@ -887,6 +1576,8 @@ static int qm35_remove(struct spi_device *spi)
 
 	misc_deregister(&qm35_hdl->uci_dev);
 
+	cancel_work_sync(&qm35_hdl->ctrl_work);
+
 	hsspi_stop(&qm35_hdl->hsspi);
 
 	hsspi_unregister(&qm35_hdl->hsspi, &qm35_hdl->log_layer.hlayer);
@@ -938,7 +1629,55 @@ static struct spi_driver qm35_spi_driver = {
 	.probe =	qm35_probe,
 	.remove =	qm35_remove,
 };
-module_spi_driver(qm35_spi_driver);
+
+static int __init qm35_init(void)
+{
+	int ret;
+
+	ret = hsspi_pools_init();
+	if (ret)
+		return ret;
+
+	ret = uci_packet_cache_init();
+	if (ret)
+		goto pools_exit;
+
+	ret = log_packet_cache_init();
+	if (ret)
+		goto uci_exit;
+
+	ret = coredump_packet_cache_init();
+	if (ret)
+		goto log_exit;
+
+	ret = spi_register_driver(&qm35_spi_driver);
+	if (ret)
+		goto coredump_exit;
+
+	return 0;
+
+coredump_exit:
+	coredump_packet_cache_exit();
+log_exit:
+	log_packet_cache_exit();
+uci_exit:
+	uci_packet_cache_exit();
+pools_exit:
+	hsspi_pools_exit();
+	return ret;
+}
+
+static void __exit qm35_exit(void)
+{
+	spi_unregister_driver(&qm35_spi_driver);
+	coredump_packet_cache_exit();
+	log_packet_cache_exit();
+	uci_packet_cache_exit();
+	hsspi_pools_exit();
+}
+
+module_init(qm35_init);
+module_exit(qm35_exit);
 
 MODULE_AUTHOR("Qorvo US, Inc.");
 MODULE_DESCRIPTION("QM35 SPI device interface");
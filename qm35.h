@@ -7,6 +7,10 @@
 #include <linux/delay.h>
 #include <linux/spi/spi.h>
 #include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/miscdevice.h>
 
 #include "uci_ioctls.h"
@@ -19,15 +23,36 @@
 #define DEBUG_CERTIFICATE_SIZE 2560
 #define QM_RESET_LOW_MS 2
 /*
- * value found using a SALAE
+ * value found using a SALAE, only used as an upper bound: the boot is
+ * complete as soon as the firmware raises ss_ready
  */
 #define QM_BOOT_MS 450
 #define QM_BEFORE_RESET_MS 450
+/* ss_ready must still be high this long after its rising edge */
+#define QM_BOOT_STABLE_US 100
 
 #define DRV_VERSION "6.3.8-rc1"
 
 struct regulator;
 
+/**
+ * struct qm35_boot_stats - QM35 boot time statistics
+ * @boots: number of boots detected
+ * @timeouts: number of boots not detected before the upper bound
+ * @last_us: last boot time
+ * @min_us: shortest boot time
+ * @max_us: longest boot time
+ * @total_us: sum of the detected boot times
+ */
+struct qm35_boot_stats {
+	u32 boots;
+	u32 timeouts;
+	u32 last_us;
+	u32 min_us;
+	u32 max_us;
+	u64 total_us;
+};
+
 /**
  * struct qm35_ctx - QM35 driver context
  *
@@ -46,6 +71,15 @@ struct qm35_ctx {
 	bool out_data_wait;
 	bool out_active;
 	bool soc_error;
+	bool booting;
+	struct completion boot_done;
+	struct qm35_boot_stats boot_stats;
+	struct mutex ctrl_lock;
+	struct work_struct ctrl_work;
+	wait_queue_head_t ctrl_wq;
+	struct qm35_ctrl_event ctrl_event;
+	bool ctrl_busy;
+	unsigned int ctrl_op;
 	struct hsspi hsspi;
 	struct uci_layer uci_layer;
 	struct coredump_layer coredump_layer;
@@ -67,10 +101,19 @@ static inline unsigned int qm35_get_state(struct qm35_ctx *qm35_hdl)
 static inline void qm35_set_state(struct qm35_ctx *qm35_hdl, int state)
 {
 	unsigned long flags;
+	bool changed;
 
 	spin_lock_irqsave(&qm35_hdl->lock, flags);
-	qm35_hdl->state = state;
+	changed = qm35_hdl->state != state;
+	if (changed) {
+		qm35_hdl->state = state;
+		qm35_hdl->ctrl_event.seq++;
+	}
 	spin_unlock_irqrestore(&qm35_hdl->lock, flags);
+
+	/* report the transition to the pollers of /dev/uci */
+	if (changed)
+		wake_up_interruptible(&qm35_hdl->ctrl_wq);
 }
 
 static inline int qm35_reset(struct qm35_ctx *qm35_hdl, int timeout_ms,
@@ -92,9 +135,39 @@ static inline int qm35_reset(struct qm35_ctx *qm35_hdl, int timeout_ms,
 
 int qm35_reset_sync(struct qm35_ctx *qm35_hdl);
 
+/**
+ * qm35_boot_wait() - wait for the QM35 firmware to boot
+ * @qm35_hdl: the &struct qm35_ctx
+ * @timeout_ms: upper bound of the boot time
+ * @irq_disabled: the ss_ready IRQ is disabled, as when the HSSPI is stopped
+ *
+ * The boot is detected when ss_ready rises and is still high
+ * QM_BOOT_STABLE_US later. Must be called with ctrl_lock held, which also
+ * protects &struct qm35_boot_stats.
+ *
+ * Return: the boot time in us or -ETIMEDOUT.
+ */
+int qm35_boot_wait(struct qm35_ctx *qm35_hdl, unsigned int timeout_ms,
+		   bool irq_disabled);
+
 int qm_get_dev_id(struct qm35_ctx *qm35_hdl, uint16_t *dev_id);
 int qm_get_soc_id(struct qm35_ctx *qm35_hdl, uint8_t *soc_id);
 
+/**
+ * qm35_set_sched() - set the scheduling of the HSSPI thread and the
+ * affinity of the QM35 IRQs
+ * @qm35_hdl: the &struct qm35_ctx
+ * @prio: SCHED_FIFO priority, 0 for SCHED_NORMAL
+ * @cpus: CPUs to run on, NULL for all
+ *
+ * The IRQs are moved first, then the thread. On error, the IRQs are put
+ * back on the CPUs of the thread, which is left unchanged.
+ *
+ * Return: 0 if no error or -errno.
+ */
+int qm35_set_sched(struct qm35_ctx *qm35_hdl, int prio,
+		   const struct cpumask *cpus);
+
 void qm35_hsspi_start(struct qm35_ctx *qm35_hdl);
 void qm35_hsspi_stop(struct qm35_ctx *qm35_hdl);
 
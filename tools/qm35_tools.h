@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 userspace tools, common helpers
+ */
+
+#ifndef __QM35_TOOLS_H___
+#define __QM35_TOOLS_H___
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../uci_ioctls.h"
+
+#define UCI_DEV_PATH "/dev/" UCI_DEV_NAME
+#define QM35_DEBUGFS "/sys/kernel/debug/uwb0"
+
+/* UCI message type, in the 3 MSB of the first byte */
+#define UCI_MT(pkt) (((const uint8_t *)(pkt))[0] >> 5)
+#define UCI_MT_RSP 2
+#define UCI_MT_NTF 3
+
+/* CORE_DEVICE_INFO_CMD, answered by any firmware state */
+static const uint8_t uci_device_info_cmd[] = { 0x20, 0x02, 0x00, 0x00 };
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static inline void *xcalloc(size_t n, size_t size)
+{
+	void *p = calloc(n, size);
+
+	if (!p)
+		die("calloc");
+	return p;
+}
+
+/*
+ * debugfs_write() - write a value to a file of the QM35 debugfs
+ *
+ * Return: 0 or -errno.
+ */
+static inline int debugfs_write(const char *name, const char *val)
+{
+	char path[256];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", QM35_DEBUGFS, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	len = write(fd, val, strlen(val));
+	close(fd);
+
+	return len < 0 ? -errno : 0;
+}
+
+/* debugfs_dump() - copy a file of the QM35 debugfs to stdout */
+static inline void debugfs_dump(const char *name)
+{
+	char path[256], buf[4096];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", QM35_DEBUGFS, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return;
+	}
+	printf("--- %s\n", name);
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, len, stdout);
+	close(fd);
+}
+
+/*
+ * debugfs_read_key() - read a "key: value" line of a QM35 debugfs file
+ *
+ * Return: 0 or -errno.
+ */
+static inline int debugfs_read_key(const char *name, const char *key,
+				   uint64_t *val)
+{
+	char path[256], line[256];
+	size_t len = strlen(key);
+	int ret = -ENOENT;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", QM35_DEBUGFS, name);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, len) && line[len] == ':') {
+			*val = strtoull(line + len + 1, NULL, 0);
+			ret = 0;
+			break;
+		}
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * uci_command() - send a UCI command and wait for its response
+ *
+ * Notifications received meanwhile are skipped.
+ *
+ * Return: the round trip time in ns or -errno.
+ */
+static inline int64_t uci_command(int fd, const void *cmd, size_t len,
+				  int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint64_t t0 = now_ns();
+	uint8_t buf[4096];
+	ssize_t n;
+
+	if (write(fd, cmd, len) < 0)
+		return -errno;
+	for (;;) {
+		n = poll(&pfd, 1, timeout_ms);
+		if (n < 0)
+			return -errno;
+		if (!n)
+			return -ETIMEDOUT;
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0)
+			return -errno;
+		if (n > 0 && UCI_MT(buf) == UCI_MT_RSP)
+			return now_ns() - t0;
+	}
+}
+
+/* UCI command given on the command line */
+struct uci_cmd {
+	uint8_t data[256];
+	size_t len;
+};
+
+/*
+ * uci_cmd_parse() - parse a UCI command written as a hex string
+ *
+ * Return: 0 or -EINVAL.
+ */
+static inline int uci_cmd_parse(const char *hex, struct uci_cmd *cmd)
+{
+	unsigned int byte;
+
+	for (cmd->len = 0; hex[0] && hex[1]; hex += 2) {
+		if (cmd->len == sizeof(cmd->data) ||
+		    sscanf(hex, "%2x", &byte) != 1)
+			return -EINVAL;
+		cmd->data[cmd->len++] = byte;
+	}
+	return hex[0] || cmd->len < 4 ? -EINVAL : 0;
+}
+
+/*
+ * uci_cmds_send() - send UCI commands in order, each waiting for its
+ * response
+ *
+ * Return: 0 or -errno of the first failing command.
+ */
+static inline int uci_cmds_send(int fd, const struct uci_cmd *cmds, int n)
+{
+	int64_t ret;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ret = uci_command(fd, cmds[i].data, cmds[i].len, 1000);
+		if (ret < 0) {
+			fprintf(stderr, "command %d: %s\n", i,
+				strerror(-ret));
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* Latency samples, in ns */
+struct lat {
+	uint64_t *ns;
+	size_t n;
+	size_t cap;
+};
+
+static inline void lat_add(struct lat *lat, uint64_t ns)
+{
+	if (lat->n == lat->cap) {
+		lat->cap = lat->cap ? 2 * lat->cap : 1024;
+		lat->ns = realloc(lat->ns, lat->cap * sizeof(*lat->ns));
+		if (!lat->ns)
+			die("realloc");
+	}
+	lat->ns[lat->n++] = ns;
+}
+
+static inline int lat_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static inline uint64_t lat_pct(const struct lat *lat, unsigned int pct10)
+{
+	return lat->ns[(lat->n - 1) * pct10 / 1000];
+}
+
+/* lat_report() - print the percentiles of the samples, in us */
+static inline void lat_report(const char *name, struct lat *lat)
+{
+	if (!lat->n) {
+		printf("%-16s no sample\n", name);
+		return;
+	}
+	qsort(lat->ns, lat->n, sizeof(*lat->ns), lat_cmp);
+	printf("%-16s n=%zu p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n",
+	       name, lat->n, lat_pct(lat, 500) / 1e3, lat_pct(lat, 900) / 1e3,
+	       lat_pct(lat, 990) / 1e3, lat_pct(lat, 999) / 1e3,
+	       lat->ns[lat->n - 1] / 1e3);
+}
+
+/*
+ * Firmware log streaming: enables the traces, sets every log module to
+ * the given level and drains fw/traces from a thread.
+ */
+struct log_stream {
+	pthread_t thread;
+	int fd;
+	volatile int stop;
+	uint64_t entries;
+	uint64_t bytes;
+};
+
+static inline void *log_stream_fn(void *arg)
+{
+	struct log_stream *ls = arg;
+	struct pollfd pfd = { .fd = ls->fd, .events = POLLIN };
+	char buf[4096];
+	ssize_t len;
+
+	while (!ls->stop) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		while ((len = read(ls->fd, buf, sizeof(buf))) > 0) {
+			ls->entries++;
+			ls->bytes += len;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * log_stream_start() - start streaming the firmware logs
+ *
+ * Return: 0 or -errno.
+ */
+static inline int log_stream_start(struct log_stream *ls, int level)
+{
+	char val[16];
+	glob_t g;
+	size_t i;
+	int ret;
+
+	memset(ls, 0, sizeof(*ls));
+	ret = debugfs_write("fw/enable", "1");
+	if (ret)
+		return ret;
+	snprintf(val, sizeof(val), "%d", level);
+	if (!glob(QM35_DEBUGFS "/fw/*/log_level", 0, NULL, &g)) {
+		for (i = 0; i < g.gl_pathc; i++)
+			debugfs_write(g.gl_pathv[i] + sizeof(QM35_DEBUGFS),
+				      val);
+		globfree(&g);
+	}
+	ls->fd = open(QM35_DEBUGFS "/fw/traces", O_RDONLY | O_NONBLOCK);
+	if (ls->fd < 0)
+		return -errno;
+	ret = pthread_create(&ls->thread, NULL, log_stream_fn, ls);
+	if (ret) {
+		close(ls->fd);
+		return -ret;
+	}
+	return 0;
+}
+
+static inline void log_stream_stop(struct log_stream *ls)
+{
+	ls->stop = 1;
+	pthread_join(ls->thread, NULL);
+	close(ls->fd);
+	debugfs_write("fw/enable", "0");
+}
+
+#endif /* __QM35_TOOLS_H___ */
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 STC controller overhead, split vs contiguous frames
+ */
+
+/*
+ * Runs the same UCI command sequence with the STC header and the
+ * payload sent as two transfers (split) and as a single one
+ * (contiguous, debugfs hsspi/contiguous), and reports for each the
+ * controller overhead measured by the driver, i.e. the transfer time
+ * not spent clocking bits, and the command round trip time.
+ *
+ * The overhead is only accounted by the driver with the user-008
+ * commit, compare the round trip times against an older module.
+ */
+
+#include <getopt.h>
+
+#include "qm35_tools.h"
+
+static const char *const layouts[] = { "split", "contiguous" };
+
+struct xfer_snapshot {
+	uint64_t frames;
+	uint64_t overhead_ns;
+};
+
+static void snapshot(const char *layout, struct xfer_snapshot *snap)
+{
+	char key[64];
+	uint64_t avg = 0;
+
+	snprintf(key, sizeof(key), "%s_frames", layout);
+	snap->frames = 0;
+	debugfs_read_key("hsspi/stats", key, &snap->frames);
+	snprintf(key, sizeof(key), "%s_avg_overhead_ns", layout);
+	debugfs_read_key("hsspi/stats", key, &avg);
+	snap->overhead_ns = avg * snap->frames;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d dev] [-n commands]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = UCI_DEV_PATH;
+	struct xfer_snapshot before, after;
+	struct lat lat;
+	int count = 2000, errors;
+	uint64_t frames, val;
+	int64_t rtt;
+	int opt, fd, i, l;
+	char prev[2] = "0";
+
+	while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	if (!debugfs_read_key("hsspi/stats", "contiguous", &val))
+		prev[0] = val ? '1' : '0';
+
+	for (l = 0; l < 2; l++) {
+		if (debugfs_write("hsspi/contiguous", l ? "1" : "0")) {
+			fprintf(stderr, "cannot select the %s layout\n",
+				layouts[l]);
+			return 1;
+		}
+		memset(&lat, 0, sizeof(lat));
+		errors = 0;
+		snapshot(layouts[l], &before);
+		for (i = 0; i < count; i++) {
+			rtt = uci_command(fd, uci_device_info_cmd,
+					  sizeof(uci_device_info_cmd), 1000);
+			if (rtt < 0)
+				errors++;
+			else
+				lat_add(&lat, rtt);
+		}
+		snapshot(layouts[l], &after);
+
+		frames = after.frames - before.frames;
+		printf("%s: frames=%llu avg_overhead=%.0f ns errors=%d\n",
+		       layouts[l], (unsigned long long)frames,
+		       frames ? (double)(after.overhead_ns -
+					 before.overhead_ns) / frames : 0.0,
+		       errors);
+		lat_report("round trip", &lat);
+		free(lat.ns);
+	}
+
+	debugfs_write("hsspi/contiguous", prev);
+	debugfs_dump("hsspi/stats");
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 UCI RX budget policies with a stalled reader
+ */
+
+/*
+ * For each QM35_RX_POLICY_*, sets a small RX budget, stops reading while
+ * UCI traffic keeps coming, then drains. Checks, from
+ * QM35_CTRL_GET_RX_STATS:
+ *  - the drop policies: the drops are counted and reported as lost;
+ *  - the backpressure: the QM35 is throttled once the budget is full;
+ *  - all of them: nothing is throttled after the drain and a command
+ *    gets its response, so RX has resumed.
+ *
+ * The responses are never dropped: drops need notifications, from a
+ * ranging session started by the -c commands and stopped by the -x
+ * ones (hex strings). Without -c, only the CORE_DEVICE_INFO commands
+ * sent while stalled feed the RX queue. The RX budget is removed at the
+ * end.
+ */
+
+#include <getopt.h>
+
+#include "qm35_tools.h"
+
+#define MAX_CMDS 16
+
+static const char *const policy_names[] = { "drop_oldest", "drop_newest",
+					    "backpressure" };
+
+static uint64_t dropped_total(const struct qm35_rx_stats *stats)
+{
+	uint64_t n = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		n += stats->dropped[i];
+	return n;
+}
+
+/* drain() - read until nothing comes for 100 ms, return the packets */
+static unsigned int drain(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint8_t buf[4096];
+	unsigned int n = 0;
+
+	while (poll(&pfd, 1, 100) > 0)
+		if (read(fd, buf, sizeof(buf)) >= 0)
+			n++;
+	return n;
+}
+
+static int get_stats(int fd, struct qm35_rx_stats *stats)
+{
+	if (ioctl(fd, QM35_CTRL_GET_RX_STATS, stats)) {
+		perror("QM35_CTRL_GET_RX_STATS");
+		return -errno;
+	}
+	return 0;
+}
+
+static int run_policy(int fd, unsigned int policy, unsigned int max_packets,
+		      int stall_ms, const struct uci_cmd *start, int nstart,
+		      const struct uci_cmd *stop, int nstop)
+{
+	struct qm35_rx_budget budget = {
+		.max_packets = max_packets,
+		.policy = policy,
+	};
+	struct qm35_rx_stats before, stalled, after;
+	unsigned int written = 0, drained;
+	uint64_t dropped, t0;
+	int failed = 0;
+	int64_t rtt;
+
+	drain(fd);
+	if (get_stats(fd, &before))
+		return 1;
+	if (ioctl(fd, QM35_CTRL_SET_RX_BUDGET, &budget)) {
+		perror("QM35_CTRL_SET_RX_BUDGET");
+		return 1;
+	}
+	if (uci_cmds_send(fd, start, nstart))
+		return 1;
+
+	/* the reader stalls while the traffic goes on */
+	t0 = now_ns();
+	while (now_ns() - t0 < stall_ms * 1000000ull) {
+		if (write(fd, uci_device_info_cmd,
+			  sizeof(uci_device_info_cmd)) >= 0)
+			written++;
+		usleep(1000);
+	}
+	if (get_stats(fd, &stalled))
+		return 1;
+
+	uci_cmds_send(fd, stop, nstop);
+	drained = drain(fd);
+	if (get_stats(fd, &after))
+		return 1;
+	rtt = uci_command(fd, uci_device_info_cmd, sizeof(uci_device_info_cmd),
+			  1000);
+
+	dropped = dropped_total(&stalled) - dropped_total(&before);
+	printf("%-12s written=%u queued=%u dropped=%llu lost=%u throttled=%u drained=%u resumed=%s\n",
+	       policy_names[policy], written, stalled.queued_packets,
+	       (unsigned long long)dropped, stalled.lost, stalled.throttled,
+	       drained, rtt < 0 ? strerror(-rtt) : "yes");
+
+	if (policy != QM35_RX_POLICY_BACKPRESSURE && dropped &&
+	    !stalled.lost) {
+		printf("  drops not reported as lost\n");
+		failed = 1;
+	}
+	if (policy == QM35_RX_POLICY_BACKPRESSURE &&
+	    stalled.queued_packets >= max_packets && !stalled.throttled) {
+		printf("  budget full but not throttled\n");
+		failed = 1;
+	}
+	if (policy != QM35_RX_POLICY_BACKPRESSURE && stalled.throttled) {
+		printf("  throttled without backpressure\n");
+		failed = 1;
+	}
+	if (after.throttled || rtt < 0) {
+		printf("  RX not resumed after the drain\n");
+		failed = 1;
+	}
+	return failed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n max_packets] [-s stall_ms] [-c hex]... [-x hex]...\n"
+		"  -n  RX budget in packets (8)\n"
+		"  -s  time the reader stalls (2000)\n"
+		"  -c  command starting the notifications\n"
+		"  -x  command stopping them\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct uci_cmd start[MAX_CMDS], stop[MAX_CMDS];
+	struct qm35_rx_budget none = {};
+	const char *dev = UCI_DEV_PATH;
+	unsigned int max_packets = 8;
+	int nstart = 0, nstop = 0;
+	int stall_ms = 2000;
+	unsigned int policy;
+	int opt, fd, failed = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:s:c:x:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			max_packets = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			stall_ms = atoi(optarg);
+			break;
+		case 'c':
+			if (nstart == MAX_CMDS ||
+			    uci_cmd_parse(optarg, &start[nstart++]))
+				usage(argv[0]);
+			break;
+		case 'x':
+			if (nstop == MAX_CMDS ||
+			    uci_cmd_parse(optarg, &stop[nstop++]))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_packets || stall_ms <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		die(dev);
+	for (policy = QM35_RX_POLICY_DROP_OLDEST;
+	     policy <= QM35_RX_POLICY_BACKPRESSURE; policy++)
+		failed |= run_policy(fd, policy, max_packets, stall_ms, start,
+				     nstart, stop, nstop);
+
+	if (ioctl(fd, QM35_CTRL_SET_RX_BUDGET, &none))
+		perror("QM35_CTRL_SET_RX_BUDGET");
+	close(fd);
+	return failed;
+}
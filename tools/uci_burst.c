@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 UCI syscalls per notification under a burst
+ */
+
+/*
+ * Counts the poll() and read() calls needed to receive the packets of a
+ * burst, one run per reception mode: one packet per read()
+ * (QM35_READ_MODE_PACKET), several per read() (QM35_READ_MODE_BATCH)
+ * and the mmap()ed RX ring. The reader drains the non-blocking file
+ * descriptor after each poll(), so the final EAGAIN reads are counted.
+ *
+ * The burst is a ranging session started by the -c commands (SESSION_INIT,
+ * SET_APP_CONFIG, RANGE_START... as hex strings, sent in order before
+ * each run) and stopped by the -x commands after it. Without -c, writev()
+ * bursts of CORE_DEVICE_INFO commands are sent for the whole run instead,
+ * which measures responses rather than notifications.
+ *
+ * The ring run is the last one: the ring stays installed until the file
+ * descriptor is closed.
+ */
+
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "qm35_tools.h"
+
+#define MAX_CMDS 16
+#define RING_SLOTS 64
+
+enum { MODE_PACKET, MODE_BATCH, MODE_RING, MODE_MAX };
+
+static const char *const mode_names[MODE_MAX] = { "packet", "batch",
+						  "ring" };
+
+struct run {
+	int fd;
+	int mode;
+	volatile int stop;
+	struct qm35_rx_ring *ring;
+	uint64_t polls;
+	uint64_t reads;
+	uint64_t packets;
+	uint64_t ntfs;
+	uint64_t writes;
+};
+
+static void count_packet(struct run *run, const uint8_t *pkt)
+{
+	run->packets++;
+	if (UCI_MT(pkt) == UCI_MT_NTF)
+		run->ntfs++;
+}
+
+static void drain_read(struct run *run)
+{
+	const struct qm35_read_hdr *hdr;
+	uint8_t buf[16384];
+	ssize_t n, off;
+
+	for (;;) {
+		run->reads++;
+		n = read(run->fd, buf, sizeof(buf));
+		if (n <= 0)
+			return;
+		if (run->mode != MODE_BATCH) {
+			count_packet(run, buf);
+			continue;
+		}
+		for (off = 0; off + (ssize_t)sizeof(*hdr) <= n;
+		     off += sizeof(*hdr) + hdr->length) {
+			hdr = (const void *)(buf + off);
+			count_packet(run, buf + off + sizeof(*hdr));
+		}
+	}
+}
+
+static void drain_ring(struct run *run)
+{
+	struct qm35_rx_ring *ring = run->ring;
+	const struct qm35_rx_slot *slot;
+	uint32_t head, tail = ring->tail;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	for (; tail != head; tail++) {
+		slot = (const void *)((uint8_t *)ring + ring->data_offset +
+				      (tail % ring->slot_count) *
+					      ring->slot_size);
+		count_packet(run, slot->data);
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void *reader_fn(void *arg)
+{
+	struct run *run = arg;
+	struct pollfd pfd = { .fd = run->fd, .events = POLLIN };
+
+	while (!run->stop) {
+		run->polls++;
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		/* the ring first, then what did not fit in it */
+		if (run->ring)
+			drain_ring(run);
+		drain_read(run);
+	}
+	return NULL;
+}
+
+/* writev() bursts of CORE_DEVICE_INFO commands */
+static void *writer_fn(void *arg)
+{
+	struct run *run = arg;
+	struct iovec iov[QM35_TX_MAX_PACKETS];
+	int i;
+
+	for (i = 0; i < QM35_TX_MAX_PACKETS; i++) {
+		iov[i].iov_base = (void *)uci_device_info_cmd;
+		iov[i].iov_len = sizeof(uci_device_info_cmd);
+	}
+	while (!run->stop) {
+		if (writev(run->fd, iov, QM35_TX_MAX_PACKETS) > 0)
+			run->writes++;
+		else
+			usleep(100);
+		usleep(10000);
+	}
+	return NULL;
+}
+
+static void run_mode(int fd, int mode, int seconds,
+		     const struct uci_cmd *start, int nstart,
+		     const struct uci_cmd *stop, int nstop)
+{
+	struct run run = { .fd = fd, .mode = mode };
+	unsigned int read_mode = mode == MODE_BATCH ? QM35_READ_MODE_BATCH :
+						      QM35_READ_MODE_PACKET;
+	pthread_t reader, writer;
+	size_t size = 0;
+	void *mem;
+
+	if (ioctl(fd, QM35_CTRL_SET_READ_MODE, &read_mode))
+		die("QM35_CTRL_SET_READ_MODE");
+	if (mode == MODE_RING) {
+		size = sysconf(_SC_PAGESIZE) + RING_SLOTS * QM35_RX_SLOT_SIZE;
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			   0);
+		if (mem == MAP_FAILED) {
+			perror("mmap");
+			return;
+		}
+		run.ring = mem;
+	}
+
+	if (uci_cmds_send(fd, start, nstart))
+		goto unmap;
+	if (pthread_create(&reader, NULL, reader_fn, &run) ||
+	    (!nstart && pthread_create(&writer, NULL, writer_fn, &run)))
+		die("pthread_create");
+	sleep(seconds);
+	run.stop = 1;
+	if (!nstart)
+		pthread_join(writer, NULL);
+	pthread_join(reader, NULL);
+	uci_cmds_send(fd, stop, nstop);
+
+	printf("%-8s packets=%llu ntfs=%llu polls=%llu reads=%llu syscalls/packet=%.2f syscalls/ntf=%.2f\n",
+	       mode_names[mode], (unsigned long long)run.packets,
+	       (unsigned long long)run.ntfs, (unsigned long long)run.polls,
+	       (unsigned long long)run.reads,
+	       run.packets ? (double)(run.polls + run.reads) / run.packets :
+			     0,
+	       run.ntfs ? (double)(run.polls + run.reads) / run.ntfs : 0);
+unmap:
+	if (run.ring)
+		munmap(run.ring, size);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-t seconds] [-c hex]... [-x hex]...\n"
+		"  -c  command starting the burst, e.g. 22000400...\n"
+		"  -x  command stopping the burst\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct uci_cmd start[MAX_CMDS], stop[MAX_CMDS];
+	const char *dev = UCI_DEV_PATH;
+	int nstart = 0, nstop = 0;
+	int seconds = 10;
+	int opt, fd, mode;
+
+	while ((opt = getopt(argc, argv, "d:t:c:x:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'c':
+			if (nstart == MAX_CMDS ||
+			    uci_cmd_parse(optarg, &start[nstart++]))
+				usage(argv[0]);
+			break;
+		case 'x':
+			if (nstop == MAX_CMDS ||
+			    uci_cmd_parse(optarg, &stop[nstop++]))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (seconds <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		die(dev);
+	for (mode = 0; mode < MODE_MAX; mode++)
+		run_mode(fd, mode, seconds, start, nstart, stop, nstop);
+	debugfs_dump("hsspi/stats");
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 /dev/uci TX contention benchmark
+ */
+
+/*
+ * Several threads write CORE_DEVICE_INFO commands to the same /dev/uci
+ * file descriptor while a reader drains the responses and, optionally,
+ * the firmware logs are streamed. At most <window> commands are
+ * outstanding. Reports the throughput and the write() latencies, which
+ * include the queuing to the HSSPI thread and the STC transaction.
+ *
+ * Run it on the same target with the old and the new module to compare
+ * the TX paths.
+ */
+
+#include <getopt.h>
+#include <semaphore.h>
+
+#include "qm35_tools.h"
+
+static int fd;
+static int count = 1000;
+static sem_t window;
+static volatile int done;
+static uint64_t responses, timeouts;
+
+struct writer {
+	pthread_t thread;
+	struct lat lat;
+	int errors;
+};
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	struct timespec ts;
+	uint64_t t0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		if (sem_timedwait(&window, &ts)) {
+			/* response lost, give the slot back */
+			__atomic_add_fetch(&timeouts, 1, __ATOMIC_RELAXED);
+		}
+		t0 = now_ns();
+		if (write(fd, uci_device_info_cmd,
+			  sizeof(uci_device_info_cmd)) < 0) {
+			w->errors++;
+			sem_post(&window);
+			continue;
+		}
+		lat_add(&w->lat, now_ns() - t0);
+	}
+	return NULL;
+}
+
+static void *reader_fn(void *arg)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint8_t buf[4096];
+	ssize_t len;
+
+	(void)arg;
+	while (!done) {
+		if (poll(&pfd, 1, 100) <= 0 || !(pfd.revents & POLLIN))
+			continue;
+		len = read(fd, buf, sizeof(buf));
+		if (len > 0 && UCI_MT(buf) == UCI_MT_RSP) {
+			responses++;
+			sem_post(&window);
+		}
+	}
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-t writers] [-n commands] [-w window] [-l level]\n"
+		"  -t  writer threads (4)\n"
+		"  -n  commands per writer (1000)\n"
+		"  -w  outstanding commands, 1 complies with UCI (writers)\n"
+		"  -l  stream the firmware logs at this level\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = UCI_DEV_PATH;
+	struct log_stream ls;
+	struct writer *writers;
+	struct lat all = {};
+	int nwriters = 4, win = 0, level = -1, errors = 0;
+	pthread_t reader;
+	uint64_t t0, elapsed;
+	size_t j;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:t:n:w:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			nwriters = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'w':
+			win = atoi(optarg);
+			break;
+		case 'l':
+			level = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nwriters <= 0 || count <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	sem_init(&window, 0, win > 0 ? win : nwriters);
+	if (level >= 0 && log_stream_start(&ls, level)) {
+		fprintf(stderr, "cannot stream the firmware logs\n");
+		level = -1;
+	}
+
+	writers = xcalloc(nwriters, sizeof(*writers));
+	if (pthread_create(&reader, NULL, reader_fn, NULL))
+		die("pthread_create");
+	t0 = now_ns();
+	for (i = 0; i < nwriters; i++)
+		if (pthread_create(&writers[i].thread, NULL, writer_fn,
+				   &writers[i]))
+			die("pthread_create");
+	for (i = 0; i < nwriters; i++)
+		pthread_join(writers[i].thread, NULL);
+	elapsed = now_ns() - t0;
+	/* let the last responses come */
+	usleep(100000);
+	done = 1;
+	pthread_join(reader, NULL);
+	if (level >= 0)
+		log_stream_stop(&ls);
+
+	for (i = 0; i < nwriters; i++) {
+		for (j = 0; j < writers[i].lat.n; j++)
+			lat_add(&all, writers[i].lat.ns[j]);
+		errors += writers[i].errors;
+	}
+	printf("writers=%d window=%d commands=%d elapsed=%.3f s\n", nwriters,
+	       win > 0 ? win : nwriters, nwriters * count, elapsed / 1e9);
+	printf("throughput=%.0f cmd/s responses=%llu timeouts=%llu errors=%d\n",
+	       all.n * 1e9 / elapsed, (unsigned long long)responses,
+	       (unsigned long long)timeouts, errors);
+	if (level >= 0)
+		printf("logs: entries=%llu bytes=%llu\n",
+		       (unsigned long long)ls.entries,
+		       (unsigned long long)ls.bytes);
+	lat_report("write", &all);
+	debugfs_dump("hsspi/stats");
+
+	close(fd);
+	return 0;
+}
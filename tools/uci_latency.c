@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 UCI tail latency under a CPU hog
+ */
+
+/*
+ * Measures the UCI command round trip time, idle, then with busy-loop
+ * threads on every CPU while the HSSPI thread is SCHED_NORMAL, then
+ * with the same hog while it is SCHED_FIFO (debugfs hsspi/sched). The
+ * measuring thread itself runs SCHED_FIFO so that the hog mostly delays
+ * the driver side. The previous scheduling of the HSSPI thread is
+ * restored at the end.
+ */
+
+#include <getopt.h>
+#include <sched.h>
+
+#include "qm35_tools.h"
+
+static volatile int hog_stop;
+
+static void *hog_fn(void *arg)
+{
+	volatile uint64_t n = 0;
+
+	(void)arg;
+	while (!hog_stop)
+		n++;
+	return NULL;
+}
+
+static void run(int fd, const char *name, int count, int interval_us)
+{
+	struct lat lat = {};
+	int errors = 0, i;
+	int64_t rtt;
+
+	for (i = 0; i < count; i++) {
+		rtt = uci_command(fd, uci_device_info_cmd,
+				  sizeof(uci_device_info_cmd), 1000);
+		if (rtt < 0)
+			errors++;
+		else
+			lat_add(&lat, rtt);
+		if (interval_us)
+			usleep(interval_us);
+	}
+	lat_report(name, &lat);
+	if (errors)
+		printf("%-16s errors=%d\n", name, errors);
+	free(lat.ns);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n commands] [-i interval_us] [-t hogs] [-p prio] [-c cpus] [-r prio]\n"
+		"  -t  hog threads (2 per online CPU)\n"
+		"  -p  SCHED_FIFO priority of the HSSPI thread (50)\n"
+		"  -c  CPU list of the HSSPI thread (all)\n"
+		"  -r  SCHED_FIFO priority of the measuring thread, 0 for none (60)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = UCI_DEV_PATH, *cpus = NULL;
+	int count = 5000, interval_us = 1000, prio = 50, rt = 60;
+	int nhogs = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+	struct sched_param sp = {};
+	uint64_t prev_prio = 0;
+	pthread_t *hogs;
+	char val[96];
+	int opt, fd, i;
+
+	while ((opt = getopt(argc, argv, "d:n:i:t:p:c:r:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'i':
+			interval_us = atoi(optarg);
+			break;
+		case 't':
+			nhogs = atoi(optarg);
+			break;
+		case 'p':
+			prio = atoi(optarg);
+			break;
+		case 'c':
+			cpus = optarg;
+			break;
+		case 'r':
+			rt = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count <= 0 || nhogs <= 0 || prio <= 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	debugfs_read_key("hsspi/sched", "prio", &prev_prio);
+	if (rt > 0) {
+		sp.sched_priority = rt;
+		if (sched_setscheduler(0, SCHED_FIFO, &sp))
+			perror("measuring thread not SCHED_FIFO");
+	}
+
+	if (debugfs_write("hsspi/sched", "0"))
+		fprintf(stderr, "cannot change the HSSPI thread scheduling\n");
+	run(fd, "idle", count, interval_us);
+
+	hogs = xcalloc(nhogs, sizeof(*hogs));
+	for (i = 0; i < nhogs; i++)
+		if (pthread_create(&hogs[i], NULL, hog_fn, NULL))
+			die("pthread_create");
+
+	run(fd, "hog normal", count, interval_us);
+
+	snprintf(val, sizeof(val), "%d %s", prio, cpus ? cpus : "");
+	if (debugfs_write("hsspi/sched", val))
+		fprintf(stderr, "cannot make the HSSPI thread SCHED_FIFO\n");
+	run(fd, "hog fifo", count, interval_us);
+
+	hog_stop = 1;
+	for (i = 0; i < nhogs; i++)
+		pthread_join(hogs[i], NULL);
+
+	/* the CPU list set with -c is not restored */
+	snprintf(val, sizeof(val), "%llu", (unsigned long long)prev_prio);
+	debugfs_write("hsspi/sched", val);
+	debugfs_dump("hsspi/latency");
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 asynchronous reset overlapping UCI traffic
+ */
+
+/*
+ * Starts QM35_CTRL_RESET_ASYNC resets at random points of a UCI command
+ * stream running on the same file descriptor: a writer thread sends
+ * commands with a TX deadline, a reader thread reads the packets and the
+ * EPOLLPRI events. The ctrl work then races the writes, the reads and
+ * the HSSPI thread. With -e, the UCI clocks are overdriven so that the
+ * HSSPI errors also reset the QM35 from the HSSPI thread
+ * (qm35_reset_hook()) while the asynchronous resets run; the previous
+ * clocks are restored at the end.
+ *
+ * Checks that every reset completes, that the event sequence only goes
+ * forward, and that a UCI command succeeds once everything is stopped.
+ */
+
+#include <getopt.h>
+
+#include "qm35_tools.h"
+
+/* must match UL_UCI_APP in hsspi.h */
+#define UL_UCI_APP 2
+
+static volatile int stop;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t seq;
+	uint32_t started;
+	uint32_t completed;
+	uint32_t failed;
+	uint32_t backwards;
+	uint64_t packets;
+	uint64_t responses;
+	uint64_t read_errors;
+} rx = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct {
+	uint64_t ok;
+	uint64_t etime;
+	uint64_t other;
+} tx;
+
+static void *writer_fn(void *arg)
+{
+	int fd = *(int *)arg;
+
+	while (!stop) {
+		if (write(fd, uci_device_info_cmd,
+			  sizeof(uci_device_info_cmd)) >= 0)
+			tx.ok++;
+		else if (errno == ETIME)
+			tx.etime++;
+		else
+			tx.other++;
+		usleep(200);
+	}
+	return NULL;
+}
+
+static void handle_event(int fd)
+{
+	struct qm35_ctrl_event ev;
+
+	if (ioctl(fd, QM35_CTRL_GET_EVENT, &ev))
+		return;
+
+	pthread_mutex_lock(&rx.lock);
+	if ((int32_t)(ev.seq - rx.seq) < 0)
+		rx.backwards++;
+	rx.seq = ev.seq;
+	if (ev.op == QM35_CTRL_OP_RESET) {
+		if (ev.result == -EINPROGRESS) {
+			rx.started++;
+		} else {
+			rx.completed++;
+			if (ev.result)
+				rx.failed++;
+		}
+	}
+	pthread_cond_broadcast(&rx.cond);
+	pthread_mutex_unlock(&rx.lock);
+}
+
+static void *reader_fn(void *arg)
+{
+	int fd = *(int *)arg;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLPRI };
+	uint8_t buf[4096];
+	ssize_t n;
+
+	while (!stop) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if (pfd.revents & POLLPRI)
+			handle_event(fd);
+		if (!(pfd.revents & POLLIN))
+			continue;
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0) {
+			rx.read_errors++;
+			continue;
+		}
+		rx.packets++;
+		if (n > 0 && UCI_MT(buf) == UCI_MT_RSP)
+			rx.responses++;
+	}
+	return NULL;
+}
+
+/*
+ * reset_async() - start a reset and wait for its completion event
+ *
+ * Return: 0, -errno of the ioctl, or -ETIMEDOUT.
+ */
+static int reset_async(int fd, int *busy)
+{
+	struct timespec ts;
+	uint32_t completed;
+	int ret = 0;
+
+	pthread_mutex_lock(&rx.lock);
+	completed = rx.completed;
+	pthread_mutex_unlock(&rx.lock);
+
+	while (ioctl(fd, QM35_CTRL_RESET_ASYNC)) {
+		if (errno != EBUSY)
+			return -errno;
+		(*busy)++;
+		usleep(10000);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 5;
+	pthread_mutex_lock(&rx.lock);
+	while (rx.completed == completed && !ret)
+		ret = -pthread_cond_timedwait(&rx.cond, &rx.lock, &ts);
+	pthread_mutex_unlock(&rx.lock);
+
+	return ret == -ETIMEDOUT ? ret : 0;
+}
+
+/* read_clocks() - read the UCI clocks from hsspi/clocks */
+static int read_clocks(unsigned int hz[3])
+{
+	char line[256];
+	unsigned int ul;
+	int ret = -ENOENT;
+	FILE *f;
+
+	f = fopen(QM35_DEBUGFS "/hsspi/clocks", "r");
+	if (!f)
+		return -errno;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "%u %u %u %u", &ul, &hz[0], &hz[1],
+			   &hz[2]) == 4 && ul == UL_UCI_APP) {
+			ret = 0;
+			break;
+		}
+	fclose(f);
+
+	return ret;
+}
+
+static int write_clocks(const unsigned int hz[3])
+{
+	char val[64];
+
+	snprintf(val, sizeof(val), "%d %u %u %u", UL_UCI_APP, hz[0], hz[1],
+		 hz[2]);
+	return debugfs_write("hsspi/clocks", val);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-n resets] [-i interval_ms] [-D deadline_us] [-e hz]\n"
+		"  -i  maximum random delay between two resets (200)\n"
+		"  -D  TX deadline of the writes (200000)\n"
+		"  -e  UCI clock overdriving the QM35 to cause error resets\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int deadline_us = 200000, overdrive_hz = 0;
+	unsigned int prev_hz[3], hz[3];
+	const char *dev = UCI_DEV_PATH;
+	int count = 50, interval_ms = 200;
+	uint64_t resets0 = 0, resets1 = 0;
+	int busy = 0, timeouts = 0, errors = 0;
+	int clocks_changed = 0;
+	pthread_t writer, reader;
+	int opt, fd, i, ret;
+	int64_t rtt;
+
+	while ((opt = getopt(argc, argv, "d:n:i:D:e:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'D':
+			deadline_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			overdrive_hz = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count <= 0 || interval_ms <= 0 || !deadline_us)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	/* a write must not block for the whole reset */
+	if (ioctl(fd, QM35_CTRL_SET_TX_DEADLINE, &deadline_us))
+		die("QM35_CTRL_SET_TX_DEADLINE");
+
+	debugfs_write("chip/boot", "0");
+	debugfs_read_key("hsspi/stats", "error_resets", &resets0);
+	if (overdrive_hz) {
+		if (read_clocks(prev_hz)) {
+			fprintf(stderr, "cannot read the UCI clocks\n");
+		} else {
+			hz[0] = hz[1] = hz[2] = overdrive_hz;
+			clocks_changed = !write_clocks(hz);
+		}
+	}
+
+	if (pthread_create(&reader, NULL, reader_fn, &fd) ||
+	    pthread_create(&writer, NULL, writer_fn, &fd))
+		die("pthread_create");
+
+	srand(getpid());
+	for (i = 0; i < count; i++) {
+		usleep((rand() % interval_ms) * 1000);
+		ret = reset_async(fd, &busy);
+		if (ret == -ETIMEDOUT)
+			timeouts++;
+		else if (ret)
+			errors++;
+	}
+
+	stop = 1;
+	pthread_join(writer, NULL);
+	pthread_join(reader, NULL);
+	if (clocks_changed)
+		write_clocks(prev_hz);
+	debugfs_read_key("hsspi/stats", "error_resets", &resets1);
+
+	/* the previous resets may leave an EPOLLPRI behind */
+	handle_event(fd);
+	rtt = uci_command(fd, uci_device_info_cmd, sizeof(uci_device_info_cmd),
+			  1000);
+
+	printf("resets: requested=%d started=%u completed=%u failed=%u busy=%d timeouts=%d errors=%d\n",
+	       count, rx.started, rx.completed, rx.failed, busy, timeouts,
+	       errors);
+	printf("error_resets: %llu\n", (unsigned long long)(resets1 - resets0));
+	printf("events: backwards=%u\n", rx.backwards);
+	printf("writes: ok=%llu etime=%llu other=%llu\n",
+	       (unsigned long long)tx.ok, (unsigned long long)tx.etime,
+	       (unsigned long long)tx.other);
+	printf("reads: packets=%llu responses=%llu errors=%llu\n",
+	       (unsigned long long)rx.packets,
+	       (unsigned long long)rx.responses,
+	       (unsigned long long)rx.read_errors);
+	debugfs_dump("chip/boot");
+	if (rtt < 0)
+		printf("final command: %s\n", strerror(-rtt));
+	else
+		printf("final command: %.1f us\n", rtt / 1e3);
+	close(fd);
+
+	return timeouts || errors || rx.backwards || rtt < 0;
+}
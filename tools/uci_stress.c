@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * This file is part of the QM35 UCI stack for linux.
+ *
+ * Copyright (c) 2022 Qorvo US, Inc.
+ *
+ * This software is provided under the GNU General Public License, version 2
+ * (GPLv2), as well as under a Qorvo commercial license.
+ *
+ * You may choose to use this software under the terms of the GPLv2 License,
+ * version 2 ("GPLv2"), as published by the Free Software Foundation.
+ * You should have received a copy of the GPLv2 along with this program.  If
+ * not, see <http://www.gnu.org/licenses/>.
+ *
+ * This program is distributed under the GPLv2 in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GPLv2 for more
+ * details.
+ *
+ * If you cannot meet the requirements of the GPLv2, you may not use this
+ * software for any purpose without first obtaining a commercial license from
+ * Qorvo.
+ * Please contact Qorvo to inquire about licensing terms.
+ *
+ * QM35 long-run fragmentation stress of the UCI and log layers
+ */
+
+/*
+ * Runs for hours the UCI and log paths while the page allocator is kept
+ * fragmented, to check that the kmalloc() backed HSSPI buffers never
+ * fail: CORE_GET_CONFIG commands asking for a random number of
+ * parameters give commands and responses of every size, the firmware
+ * logs are streamed at the given level, and a thread keeps allocating
+ * and freeing random sized chunks of memory.
+ *
+ * Every period, prints the command errors, the RTT percentiles, the log
+ * throughput, the free high-order blocks of /proc/buddyinfo and the HSSPI
+ * work high water. Any command error fails the run.
+ */
+
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include "qm35_tools.h"
+
+/* the response, 3 bytes per parameter, must fit in 255 bytes */
+#define UCI_GET_CONFIG_MAX 80
+#define FRAG_CHUNKS 4096
+
+static volatile int stop;
+
+/* CORE_GET_CONFIG of n parameters, DEVICE_STATE or LOW_POWER_MODE */
+static size_t get_config_cmd(uint8_t *cmd, unsigned int n)
+{
+	unsigned int i;
+
+	cmd[0] = 0x20;
+	cmd[1] = 0x05;
+	cmd[2] = 0x00;
+	cmd[3] = n + 1;
+	cmd[4] = n;
+	for (i = 0; i < n; i++)
+		cmd[5 + i] = rand() & 1;
+	return 5 + n;
+}
+
+/* free blocks of order 3 and more, in pages, from /proc/buddyinfo */
+static uint64_t buddy_high_order_pages(void)
+{
+	unsigned long count;
+	char line[512], *p;
+	uint64_t pages = 0;
+	int order, n;
+	FILE *f;
+
+	f = fopen("/proc/buddyinfo", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		p = strstr(line, "zone");
+		if (!p)
+			continue;
+		/* skip "zone <name>" */
+		p = strchr(p + 5, ' ');
+		for (order = 0; p && sscanf(p, "%lu%n", &count, &n) == 1;
+		     order++, p += n)
+			if (order >= 3)
+				pages += (uint64_t)count << order;
+	}
+	fclose(f);
+
+	return pages;
+}
+
+/* keeps up to max_mb of random sized chunks, freeing random ones */
+static void *frag_fn(void *arg)
+{
+	size_t max = *(size_t *)arg, used = 0, size;
+	static struct {
+		void *p;
+		size_t size;
+	} chunks[FRAG_CHUNKS];
+	int i;
+
+	while (!stop) {
+		i = rand() % FRAG_CHUNKS;
+		if (chunks[i].p) {
+			munmap(chunks[i].p, chunks[i].size);
+			used -= chunks[i].size;
+			chunks[i].p = NULL;
+			continue;
+		}
+		size = (1 + rand() % 16) * sysconf(_SC_PAGESIZE);
+		if (used + size > max)
+			continue;
+		chunks[i].p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+				   -1, 0);
+		if (chunks[i].p == MAP_FAILED) {
+			chunks[i].p = NULL;
+			continue;
+		}
+		chunks[i].size = size;
+		used += size;
+	}
+	for (i = 0; i < FRAG_CHUNKS; i++)
+		if (chunks[i].p)
+			munmap(chunks[i].p, chunks[i].size);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-t seconds] [-p period] [-l level] [-m MB]\n"
+		"  -t  duration (3600)\n"
+		"  -p  report period (60)\n"
+		"  -l  firmware log level, -1 for no logs (4)\n"
+		"  -m  memory kept fragmented (256)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = 3600, period = 60, level = 4, mb = 256;
+	uint8_t cmd[5 + UCI_GET_CONFIG_MAX];
+	const char *dev = UCI_DEV_PATH;
+	uint64_t start, next, commands = 0, errors = 0;
+	uint64_t high_water = 0, log_bytes = 0;
+	struct log_stream ls;
+	struct lat lat = {};
+	int logs = 0, opt, fd;
+	pthread_t frag;
+	size_t max;
+	int64_t rtt;
+	size_t len;
+
+	while ((opt = getopt(argc, argv, "d:t:p:l:m:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 'l':
+			level = atoi(optarg);
+			break;
+		case 'm':
+			mb = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (seconds <= 0 || period <= 0 || mb < 0)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0)
+		die(dev);
+	if (level >= 0) {
+		if (log_stream_start(&ls, level))
+			fprintf(stderr, "cannot stream the firmware logs\n");
+		else
+			logs = 1;
+	}
+	max = (size_t)mb << 20;
+	srand(getpid());
+	if (pthread_create(&frag, NULL, frag_fn, &max))
+		die("pthread_create");
+
+	printf("start: high_order_pages=%llu\n",
+	       (unsigned long long)buddy_high_order_pages());
+	start = now_ns();
+	next = start + period * 1000000000ull;
+	while (now_ns() - start < seconds * 1000000000ull) {
+		len = get_config_cmd(cmd, 1 + rand() % UCI_GET_CONFIG_MAX);
+		rtt = uci_command(fd, cmd, len, 1000);
+		commands++;
+		if (rtt < 0) {
+			errors++;
+			fprintf(stderr, "command %llu: %s\n",
+				(unsigned long long)commands, strerror(-rtt));
+		} else {
+			lat_add(&lat, rtt);
+		}
+
+		if (now_ns() < next)
+			continue;
+		next += period * 1000000000ull;
+		debugfs_read_key("hsspi/stats", "works_high_water",
+				 &high_water);
+		if (logs)
+			log_bytes = ls.bytes;
+		printf("%llus: commands=%llu errors=%llu log_bytes=%llu high_order_pages=%llu works_high_water=%llu\n",
+		       (unsigned long long)((now_ns() - start) / 1000000000ull),
+		       (unsigned long long)commands,
+		       (unsigned long long)errors,
+		       (unsigned long long)log_bytes,
+		       (unsigned long long)buddy_high_order_pages(),
+		       (unsigned long long)high_water);
+		lat_report("rtt", &lat);
+		lat.n = 0;
+		fflush(stdout);
+	}
+
+	stop = 1;
+	pthread_join(frag, NULL);
+	if (logs)
+		log_stream_stop(&ls);
+	debugfs_dump("hsspi/stats");
+	free(lat.ns);
+	close(fd);
+
+	return errors != 0;
+}
@@ -4,14 +4,142 @@
 #define __UCI_IOCTLS_H___
 
 #include <asm/ioctl.h>
+#include <linux/types.h>
 
 #define UCI_DEV_NAME "uci"
 #define UCI_IOC_TYPE 'U'
 
+/* largest number of UCI packets of a writev(), more fail with EINVAL */
+#define QM35_TX_MAX_PACKETS 8
+
 #define QM35_CTRL_RESET _IOR(UCI_IOC_TYPE, 1, unsigned int)
 #define QM35_CTRL_GET_STATE _IOR(UCI_IOC_TYPE, 2, unsigned int)
 #define QM35_CTRL_FW_UPLOAD _IOR(UCI_IOC_TYPE, 3, unsigned int)
 #define QM35_CTRL_POWER _IOW(UCI_IOC_TYPE, 4, unsigned int)
+/* deadline in us applied to the following writes, 0 to disable */
+#define QM35_CTRL_SET_TX_DEADLINE _IOW(UCI_IOC_TYPE, 5, unsigned int)
+#define QM35_CTRL_GET_TX_STATS _IOR(UCI_IOC_TYPE, 6, struct qm35_tx_stats)
+/* asynchronous variants, completion is reported with EPOLLPRI */
+#define QM35_CTRL_RESET_ASYNC _IO(UCI_IOC_TYPE, 7)
+#define QM35_CTRL_FW_UPLOAD_ASYNC _IO(UCI_IOC_TYPE, 8)
+#define QM35_CTRL_POWER_ASYNC _IOW(UCI_IOC_TYPE, 9, unsigned int)
+/* read-out of the last event, acknowledges the EPOLLPRI */
+#define QM35_CTRL_GET_EVENT _IOR(UCI_IOC_TYPE, 10, struct qm35_ctrl_event)
+/* QM35_READ_MODE_* of the following reads */
+#define QM35_CTRL_SET_READ_MODE _IOW(UCI_IOC_TYPE, 11, unsigned int)
+/* first error of the O_NONBLOCK writes not reported yet, then cleared */
+#define QM35_CTRL_GET_TX_ERROR _IOR(UCI_IOC_TYPE, 12, int)
+#define QM35_CTRL_SET_RX_BUDGET _IOW(UCI_IOC_TYPE, 13, struct qm35_rx_budget)
+#define QM35_CTRL_GET_RX_STATS _IOR(UCI_IOC_TYPE, 14, struct qm35_rx_stats)
+
+/* per file descriptor TX statistics */
+struct qm35_tx_stats {
+	/* writes failed with ETIME because their deadline passed */
+	__u32 deadline_missed;
+};
+
+/*
+ * Read modes: one UCI packet per read(), or as many whole UCI packets as
+ * fit in the buffer, each preceded by a struct qm35_read_hdr.
+ */
+enum { QM35_READ_MODE_PACKET = 0,
+       QM35_READ_MODE_BATCH,
+};
+
+/* some packets were dropped before this one */
+#define QM35_READ_FLAG_LOST 0x1
+
+struct qm35_read_hdr {
+	/* length of the UCI packet following the header */
+	__u32 length;
+	/* QM35_READ_FLAG_* */
+	__u32 flags;
+	/* CLOCK_MONOTONIC reception time */
+	__u64 timestamp_ns;
+};
+
+/*
+ * Policies applied when the received packets not read yet exceed the RX
+ * budget: drop the oldest or the newest packets, responses excepted, or
+ * stop reading the QM35 until some packets are read.
+ */
+enum { QM35_RX_POLICY_DROP_OLDEST = 0,
+       QM35_RX_POLICY_DROP_NEWEST,
+       QM35_RX_POLICY_BACKPRESSURE,
+};
+
+struct qm35_rx_budget {
+	/* maximum number of packets, 0 for no limit */
+	__u32 max_packets;
+	/* maximum number of bytes, 0 for no limit */
+	__u32 max_bytes;
+	/* QM35_RX_POLICY_* */
+	__u32 policy;
+};
+
+struct qm35_rx_stats {
+	/* packets dropped, indexed by UCI message type */
+	__u64 dropped[8];
+	/* packets and bytes waiting to be read */
+	__u32 queued_packets;
+	__u32 queued_bytes;
+	/* the QM35 is not read because of the backpressure */
+	__u32 throttled;
+	/*
+	 * some packets were dropped since the last report, by this ioctl or
+	 * by a QM35_READ_FLAG_LOST: the reads of QM35_READ_MODE_PACKET and
+	 * of the ring don't carry it
+	 */
+	__u32 lost;
+};
+
+/*
+ * Shared RX ring, created by mmap() of /dev/uci: a struct qm35_rx_ring
+ * page followed by slot_count slots of slot_size bytes from data_offset.
+ * The driver fills the slot head % slot_count then increments head,
+ * userspace consumes up to head then writes tail. A slot holds one UCI
+ * packet, the driver splits the STC payloads holding several of them.
+ * Packets which do not fit go to read() as before: consume the ring
+ * first to keep the order.
+ */
+#define QM35_RX_SLOT_SIZE 2048
+
+struct qm35_rx_ring {
+	/* written by the driver */
+	__u32 head;
+	/* written by userspace */
+	__u32 tail;
+	__u32 slot_size;
+	__u32 slot_count;
+	__u32 data_offset;
+};
+
+struct qm35_rx_slot {
+	__u32 length;
+	/* used by the driver */
+	__u32 reserved[3];
+	__u8 data[];
+};
+
+/* asynchronous operations */
+enum { QM35_CTRL_OP_NONE = 0,
+       QM35_CTRL_OP_RESET,
+       QM35_CTRL_OP_FW_UPLOAD,
+       QM35_CTRL_OP_POWER_OFF,
+       QM35_CTRL_OP_POWER_ON,
+};
+
+/* state change or asynchronous operation completion */
+struct qm35_ctrl_event {
+	/* incremented on each state change, start and end of operation */
+	__u32 seq;
+	/* current QM35_CTRL_STATE_* */
+	__u32 state;
+	/* last asynchronous QM35_CTRL_OP_* */
+	__u32 op;
+	/* its result, -EINPROGRESS while it runs */
+	__s32 result;
+};
 
 /* qm35 states */
 enum { QM35_CTRL_STATE_UNKNOWN = 0x0000,